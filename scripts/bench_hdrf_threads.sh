@@ -0,0 +1,21 @@
+#!/bin/bash
+# Scaling and replication factor of parallel HDRF against the serial run (-threads 1)
+# usage: ./bench_hdrf_threads.sh [dataset] [p]
+
+bin=${BIN:-../build/main}
+dataset=${1:-../../dataset/am}
+p=${2:-32}
+
+printf "%-8s %-16s %-12s %s\n" threads "partition time" speedup "replication factor"
+for threads in 1 2 4 8 16 32; do
+    log=$(mktemp)
+    $bin -p $p -method hdrf -threads $threads -filename $dataset > $log 2>&1
+    time=$(grep -a "\] partition time" $log | head -1 | awk '{print $NF}')
+    rf=$(grep -a "replication factor (final)" $log | awk '{print $NF}')
+    if [ $threads -eq 1 ]; then
+        serial=$time
+    fi
+    speedup=$(awk "BEGIN { printf \"%.2f\", $serial / $time }")
+    printf "%-8s %-16s %-12s %s\n" $threads $time $speedup $rf
+    rm -f $log
+done
@@ -2,6 +2,7 @@
 
 #include "bpart_partitioner.hpp"
 #include "conversions.hpp"
+#include "stream_order.hpp"
 #include <omp.h>
 
 template <typename TAdj>
@@ -43,6 +44,7 @@ BPartPartitioner<TAdj>::BPartPartitioner(std::string basefilename, bool need_k_s
 
 
     vertex2bucket.assign(num_vertices, kInvalidBid);
+    sub_bucket.assign(num_vertices, kInvalidBid);
     // capacity = static_cast<double>(num_edges) * 2 * 1.05 / FLAGS_p + 1; //will be used to as stopping criterion later
     // capacity = 1e18; //will be used to as stopping criterion later
 
@@ -65,10 +67,8 @@ void BPartPartitioner<TAdj>::split()
     vid_t aim_subgraph_vertex = (num_vertices + FLAGS_p - 1) / FLAGS_p;
     eid_t aim_subgraph_edge = (num_edges + FLAGS_p - 1) / FLAGS_p;
 
-    // std::vector<vid_t> order(num_vertices);
-    // std::iota(order.begin(), order.end(), (vid_t)0);
-    // std::mt19937 engine(123);
-    // std::shuffle(order.begin(), order.end(), engine);
+    // vertices not in a finished partition yet, in stream order
+    std::vector<vid_t> unfinished = stream_order(graph, FLAGS_order, FLAGS_seed, FLAGS_threads);
 
     int num_finished_partition = 0;
     int num_remain_partition = FLAGS_p;
@@ -84,17 +84,13 @@ void BPartPartitioner<TAdj>::split()
 
         // fine-grained 
         w_.assign(num_under_partition, 0);
-        is_boundarys.assign(num_under_partition, dense_bitset(num_vertices));
-        num_bucket_vertices.assign(num_under_partition, 0);
+        intra_costs.assign(num_under_partition, intra_partition_cost(0));
+        neighbor_buckets.init(num_under_partition);
+        num_bucket_vertices.assign(num_under_partition);
         occupied.assign(num_under_partition, 0);
 
-        for (vid_t v = 0; v < num_vertices; ++v) {
-            // vid_t vid = order[v];
-            vid_t vid = v;
-            // already in fininshed partition
-            if (vertex2bucket[vid] != kInvalidBid) {
-                continue;
-            }
+        for (vid_t v = 0; v < unfinished.size(); ++v) {
+            vid_t vid = unfinished[v];
             if (v % 5'000'000 == 0) {
                 LOG(INFO) << "Vertex processed " << v;
             }
@@ -103,7 +99,8 @@ void BPartPartitioner<TAdj>::split()
             assign_vertex(bucket, vid, additional_edges);
         }
 
-        std::vector<vid_t> num_last_round_vertex(num_bucket_vertices);
+        std::vector<vid_t> num_last_round_vertex(num_bucket_vertices.values().begin(),
+                                                num_bucket_vertices.values().end());
         std::vector<eid_t> num_last_round_edge(occupied);
 
         std::vector<uint32_t> id_last_round(num_under_partition);
@@ -175,6 +172,8 @@ void BPartPartitioner<TAdj>::split()
             aim_subgraph_edge;
         LOG(INFO) << static_cast<double>(aim_subgraph_vertex) * balance_factor << ' ' << static_cast<double>(aim_subgraph_edge) * balance_factor;
         
+        // final bucket of each finished group, by its root
+        std::vector<bid_t> finished_bucket(num_under_partition, kInvalidBid);
         for (size_t bucket = 0; bucket < parent.size(); ++bucket) {
             if (bucket != parent[bucket])   continue;
             double delta_vertex = static_cast<double>(num_last_round_vertex[bucket]) - aim_subgraph_vertex;
@@ -185,21 +184,22 @@ void BPartPartitioner<TAdj>::split()
             if ((std::abs(delta_vertex) < static_cast<double>(aim_subgraph_vertex) * balance_factor 
                 && std::abs(delta_edge) < static_cast<double>(aim_subgraph_edge) * balance_factor) 
                     or iter == 1 or FLAGS_p - num_finished_partition <= 2) {
-                
-                // #pragma omp parallel for
-                for (size_t b = 0; b < parent.size(); ++b) {
-                    if (parent[b] != bucket) continue;
-                    for (vid_t vid = 0; vid < num_vertices; ++vid) {
-                        if (is_boundarys[b].get(vid)) {
-                            vertex2bucket[vid] = num_finished_partition;
-                        }
-                    }
-                }
-
+                finished_bucket[bucket] = num_finished_partition;
                 LOG(INFO) << "bucket: " << bucket << " is ok!";
                 ++num_finished_partition;
             }
         }
+
+        #pragma omp parallel for num_threads(FLAGS_threads)
+        for (vid_t v = 0; v < unfinished.size(); ++v) {
+            vid_t vid = unfinished[v];
+            vertex2bucket[vid] = finished_bucket[parent[sub_bucket[vid]]];
+            // the next iteration starts over, and finished vertices never count as neighbors
+            sub_bucket[vid] = kInvalidBid;
+        }
+        unfinished.erase(std::remove_if(unfinished.begin(), unfinished.end(),
+                                        [&](vid_t vid) { return vertex2bucket[vid] != kInvalidBid; }),
+                         unfinished.end());
         ++iter;
     }
     
@@ -209,13 +209,15 @@ void BPartPartitioner<TAdj>::split()
     
     num_partitions = FLAGS_p;
     w_.assign(num_partitions, 0);
+    intra_costs.assign(num_partitions, intra_partition_cost(0));
     is_boundarys.assign(num_partitions, dense_bitset(num_vertices));
-    num_bucket_vertices.assign(num_partitions, 0);
+    num_bucket_vertices.assign(num_partitions);
     occupied.assign(num_partitions, 0);
 
     for (vid_t vid = 0; vid < num_vertices; ++vid) {
         bid_t bucket = vertex2bucket[vid];
         writer.save_vertex(vid, bucket);
+        is_boundarys[bucket].set_bit_unsync(vid);
         assign_vertex(bucket, vid, 0);
     }
 
@@ -253,37 +255,22 @@ BPartPartitioner<TAdj>::best_scored_partition(vid_t vid)
 {
 	double best_score = -1e18;
 	bid_t best_partition = kInvalidBid;
-    eid_t final_additional_edges = 0;
-	for (bid_t b = 0; b < num_partitions; ++b) {
-        if (w_[b] >= capacity)  continue;
-		const auto &[score, additional_edges] = compute_partition_score(vid, b);
-        if (score > best_score) {
-            best_score = score;
-            best_partition = b;
-            final_additional_edges = additional_edges;
+    neighbor_buckets.build(graph[vid], sub_bucket);
+    // w_ never is below the vertex count, so every bucket is full once the smallest one is
+    if (num_bucket_vertices.min() < capacity) {
+        for (bid_t b = 0; b < num_partitions; ++b) {
+            if (w_[b] >= capacity)  continue;
+            double score = (double)neighbor_buckets[b] - intra_costs[b];
+            if (score > best_score) {
+                best_score = score;
+                best_partition = b;
+            }
         }
-	}
+    }
     if (best_partition == kInvalidBid) {
         best_partition = gen() % num_partitions;
-        const auto &[overlap, neighbors_cnt] = overlap_partition_vertex(vid, best_partition);
-        final_additional_edges = neighbors_cnt - overlap;
     }
-	return {best_partition, final_additional_edges};
-}
-
-template <typename TAdj>
-std::tuple<vid_t, vid_t>
-BPartPartitioner<TAdj>::overlap_partition_vertex(vid_t vid, bid_t bucket_id) 
-{
-    AdjList<AdjEntryVid>& neighbors = graph[vid];
-    vid_t overlap = 0, neighbors_cnt = neighbors.size();
-    for (vid_t i = 0; i < neighbors.size(); ++i) {
-        vid_t uid = neighbors[i].vid;
-        if (is_boundarys[bucket_id].get(uid)) {
-            ++overlap;
-        }
-    }
-    return {overlap, neighbors_cnt};
+	return {best_partition, graph[vid].size() - neighbor_buckets[best_partition]};
 }
 
 template <typename TAdj>
@@ -292,22 +279,13 @@ double BPartPartitioner<TAdj>::intra_partition_cost(double size)
     return alpha * gamma * pow(size, gamma - 1.0);
 }
 
-template <typename TAdj>
-std::tuple<double, vid_t> 
-BPartPartitioner<TAdj>::compute_partition_score(vid_t vid, bid_t bucket_id) 
-{
-    double intra_partition_score = intra_partition_cost(w_[bucket_id]);
-    const auto &[overlap, neighbors_cnt] = overlap_partition_vertex(vid, bucket_id);
-    double inter_partition_score = overlap;
-	return {inter_partition_score - intra_partition_score, neighbors_cnt - overlap};
-}
-
 template <typename TAdj>
 void BPartPartitioner<TAdj>::assign_vertex(bid_t bucket, vid_t vid, eid_t additional_edges)
 {
-    is_boundarys[bucket].set_bit_unsync(vid);
+    sub_bucket[vid] = bucket;
     
-    num_bucket_vertices[bucket] += 1;
+    num_bucket_vertices.increment(bucket);
     occupied[bucket] += 0;
     w_[bucket] = static_cast<double>(num_bucket_vertices[bucket]) + occupied[bucket] * 2.0 / average_degree;
+    intra_costs[bucket] = intra_partition_cost(w_[bucket]);
 }
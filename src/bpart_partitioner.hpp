@@ -3,7 +3,9 @@
 
 #include <random>
 
+#include "bucket_histogram.hpp"
 #include "dense_bitset.hpp"
+#include "load_tracker.hpp"
 #include "part_writer.hpp"
 #include "graph.hpp"
 #include "ne_graph.hpp"
@@ -30,12 +32,13 @@ class BPartPartitioner : public AdjListVPartitioner<TAdj>
 
     double c_ = 0.5;
     
-    std::vector<vid_t> num_bucket_vertices;
+    LoadTracker num_bucket_vertices;
 
     Graph<AdjEntryVid> graph;
     std::vector<double> w_;
     VertexpartWriter<vid_t, bid_t> writer;
     std::vector<bid_t> vertex2bucket;
+    std::vector<bid_t> sub_bucket; // fine-grained bucket of the current iteration
     double average_degree;
     double capacity;
 
@@ -49,14 +52,14 @@ class BPartPartitioner : public AdjListVPartitioner<TAdj>
 
     double intra_partition_cost(double size);
 
-    std::tuple<vid_t, vid_t> overlap_partition_vertex(vid_t vid, bid_t bucket_id);
+    std::vector<double> intra_costs;  // intra_partition_cost(w_[b]), refreshed when w_[b] changes
+    BucketHistogram neighbor_buckets; // neighbors per sub bucket of the vertex being placed
 
     /// @ref: https://github.com/ustcadsl/BPart/blob/master/include/graph.hpp#L858
     void assign_vertex(bid_t bucket, vid_t vid, eid_t additional_edges);
     
     /// @return: <final bucket, additional edges> whose score is best for vertex v
     std::tuple<bid_t, eid_t> best_scored_partition(vid_t v); 
-    std::tuple<double, vid_t> compute_partition_score(vid_t vid, bid_t bucket_id);
 
   public:
     BPartPartitioner(std::string basefilename, bool need_k_split);
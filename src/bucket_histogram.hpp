@@ -0,0 +1,46 @@
+#ifndef BUCKET_HISTOGRAM_HPP
+#define BUCKET_HISTOGRAM_HPP
+
+#include "common.hpp"
+#include "graph.hpp"
+
+/* Neighbors per bucket of one vertex, built with a single pass over its
+ * neighbors and a vertex to bucket array. Only the buckets that were hit
+ * are reset for the next vertex. */
+class BucketHistogram
+{
+  private:
+    std::vector<vid_t> counts;
+    std::vector<bid_t> touched;
+
+  public:
+    void init(size_t num_buckets)
+    {
+        counts.assign(num_buckets, 0);
+        touched.clear();
+    }
+
+    template <typename TAdj>
+    void build(AdjList<TAdj> &neighbors, const std::vector<bid_t> &vertex2bucket)
+    {
+        clear();
+        for (vid_t i = 0; i < neighbors.size(); ++i) {
+            bid_t b = vertex2bucket[neighbors[i].vid];
+            if (b != kInvalidBid && counts[b]++ == 0) {
+                touched.push_back(b);
+            }
+        }
+    }
+
+    void clear()
+    {
+        for (bid_t b : touched) {
+            counts[b] = 0;
+        }
+        touched.clear();
+    }
+
+    vid_t operator[](bid_t b) const { return counts[b]; }
+};
+
+#endif
@@ -19,6 +19,13 @@ DECLARE_string(method);
 DECLARE_string(write);
 
 DECLARE_double(hdf);
+DECLARE_int32(memsize);
+DECLARE_int32(stream_chunk);
+DECLARE_int32(threads);
+DECLARE_int32(passes);
+DECLARE_string(order);
+DECLARE_int32(seed);
+DECLARE_string(levels);
 DECLARE_double(lambda);
 DECLARE_bool(write_low_degree_edgelist);
 DECLARE_bool(extended_metrics);
@@ -26,9 +33,16 @@ DECLARE_bool(hybrid_NE);
 
 using vid_t = uint32_t;
 using eid_t = uint64_t;
+// bucket ids are 8-bit (at most 254 buckets); the main_wide build
+// (-DWIDE_BID) makes them 16-bit for more partitions
+#ifdef WIDE_BID
+using bid_t = uint16_t;
+#else
 using bid_t = uint8_t;
+#endif
 const vid_t kInvalidVid = std::numeric_limits<vid_t>::max();
 const bid_t kInvalidBid = std::numeric_limits<bid_t>::max();
+const size_t kMaxBuckets = (size_t)kInvalidBid + 1;
 const vid_t offset = (vid_t)1 << 31;
 
 struct edge_t {
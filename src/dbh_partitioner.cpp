@@ -1,4 +1,5 @@
 #include <numeric>
+#include <omp.h>
 
 #include "dbh_partitioner.hpp"
 #include "graph.hpp"
@@ -50,7 +51,9 @@ DbhPartitioner::DbhPartitioner(std::string basefilename, bool need_k_split)
     is_boundarys.assign(num_partitions, dense_bitset(num_vertices));
     occupied.assign(num_partitions, 0);
     avg_edge_cnt = (double)num_edges / FLAGS_p;
-    // edgelist2bucket.assign(num_edges, kInvalidBid);
+    if (need_k_split) {
+        edgelist2bucket.assign(num_edges, kInvalidBid);
+    }
 
     degrees.resize(num_vertices);
     std::ifstream degree_file(degree_name(basefilename), std::ios::binary);
@@ -61,34 +64,68 @@ DbhPartitioner::DbhPartitioner(std::string basefilename, bool need_k_split)
 void DbhPartitioner::split()
 {
     partition_time.start();
-    bid_t bucket;
-
-    std::vector<edge_t> stream_edges; // temporary buffer to read edges from file
-    eid_t chunk_size = std::min(num_edges, (eid_t)100000);
-    eid_t num_remaining_edges = num_edges; // number of edges to be read from file
-
-    std::ifstream fin(binedgelist_name(basefilename),
-                      std::ios::binary | std::ios::ate);
-    fin.seekg(sizeof(num_vertices) + sizeof(num_edges), std::ios::beg); 
+    if (FLAGS_threads > 1) {
+        parallel_split();
+        return;
+    }
 
-    stream_edges.resize(chunk_size);
+    EdgeStream stream(binedgelist_name(basefilename), sizeof(num_vertices) + sizeof(num_edges), num_edges);
+    const edge_t *stream_edges;
+    eid_t chunk_size;
 
     eid_t num_edges_read = 0; // number of edges read from file
-    while (num_remaining_edges > 0) { // edges to be read
-        fin.read((char *)&stream_edges[0], sizeof(edge_t) * chunk_size);
+    while ((chunk_size = stream.next(stream_edges)) > 0) {
         for (eid_t i = 0; i < chunk_size; ++i, ++num_edges_read) {
             const auto& [u, v] = stream_edges[i];
-            vid_t w = degrees[u] <= degrees[v] ? u : v;
-            bucket = w % num_partitions;
-            assign_edge(bucket, u, v, num_edges_read);
+            assign_edge(bucket_of(u, v), u, v, num_edges_read);
             if (num_edges_read % 50000000 == 0) {
                 LOG(INFO) << "Processing edges " << num_edges_read;
             }
         }
+    }
+
+    partition_time.stop();
+    total_time.stop();
+    LOG(INFO) << "partition time: " << partition_time.get_time();
+    calculate_stats();
+}
+
+// The bucket of an edge only depends on the degrees, so threads take
+// disjoint slices of the mapped edges with private counters and output
+// buffers; only the replica bits are shared.
+void DbhPartitioner::parallel_split()
+{
+    const int num_threads = FLAGS_threads;
+    LOG(INFO) << "parallel DBH with " << num_threads << " threads";
+    EdgeMap edge_map(binedgelist_name(basefilename), sizeof(num_vertices) + sizeof(num_edges), num_edges);
+    const edge_t *mapped_edges = edge_map.edges();
+
+    #pragma omp parallel num_threads(num_threads)
+    {
+        std::vector<eid_t> local_occupied(num_partitions, 0);
+        EdgepartBlockWriter<vid_t, bid_t> block_writer(*writer);
+
+        #pragma omp for schedule(static)
+        for (eid_t eid = 0; eid < num_edges; ++eid) {
+            const auto& [u, v] = mapped_edges[eid];
+            bid_t bucket = bucket_of(u, v);
+            ++local_occupied[bucket];
+            if (!edgelist2bucket.empty()) {
+                edgelist2bucket[eid] = bucket;
+            }
+            if (!is_boundarys[bucket].get(u)) {
+                is_boundarys[bucket].set_bit(u);
+            }
+            if (!is_boundarys[bucket].get(v)) {
+                is_boundarys[bucket].set_bit(v);
+            }
+            block_writer.save_edge(u, v, bucket);
+        }
 
-        num_remaining_edges -= chunk_size;
-        if (num_remaining_edges < chunk_size) { // adapt chunk size for last batch read
-            chunk_size = num_remaining_edges;
+        block_writer.flush();
+        #pragma omp critical
+        for (bid_t b = 0; b < num_partitions; ++b) {
+            occupied[b] += local_occupied[b];
         }
     }
 
@@ -4,6 +4,7 @@
 #include <memory>
 
 #include "dense_bitset.hpp"
+#include "edge_stream.hpp"
 #include "part_writer.hpp"
 #include "ne_graph.hpp"
 #include "partitioner.hpp"
@@ -22,12 +23,23 @@ class DbhPartitioner : public EdgeListEPartitioner
     void assign_edge(bid_t bucket, vid_t from, vid_t to, eid_t edge_id)
     {
         writer->save_edge(from, to, bucket);
-        // edgelist2bucket[edge_id] = bucket;
+        if (!edgelist2bucket.empty()) {
+            edgelist2bucket[edge_id] = bucket;
+        }
         ++occupied[bucket];
         is_boundarys[bucket].set_bit_unsync(from);
         is_boundarys[bucket].set_bit_unsync(to);
     }
 
+    /// the endpoint of lower degree decides the bucket
+    bid_t bucket_of(vid_t u, vid_t v) const
+    {
+        vid_t w = degrees[u] <= degrees[v] ? u : v;
+        return w % num_partitions;
+    }
+
+    void parallel_split(); // -threads > 1
+
   public:
     DbhPartitioner(std::string basefilename, bool need_k_split);
     void split();
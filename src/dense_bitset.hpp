@@ -24,9 +24,25 @@ class dense_bitset
         *this = db;
     }
 
+    dense_bitset(dense_bitset &&db) noexcept : array(db.array), len(db.len), arrlen(db.arrlen)
+    {
+        db.array = nullptr;
+        db.len = 0;
+        db.arrlen = 0;
+    }
+
     /// destructor
     ~dense_bitset() { free(array); }
 
+    /// Takes the bits of db, which gets the bits of this bitset
+    inline dense_bitset &operator=(dense_bitset &&db) noexcept
+    {
+        std::swap(array, db.array);
+        std::swap(len, db.len);
+        std::swap(arrlen, db.arrlen);
+        return *this;
+    }
+
     /// Make a copy of the bitset db
     inline dense_bitset &operator=(const dense_bitset &db)
     {
@@ -378,6 +394,12 @@ class dense_bitset
         return ret;
     }
 
+    /// compares the words, the trailing bits are always zero
+    bool operator==(const dense_bitset &other) const
+    {
+        return len == other.len && memcmp(array, other.array, sizeof(size_t) * arrlen) == 0;
+    }
+
     dense_bitset operator&(const dense_bitset &other) const
     {
         CHECK_EQ(size(), other.size());
@@ -426,6 +448,26 @@ class dense_bitset
         return *this;
     }
 
+    /// the words of the bitset, for saving and loading it
+    size_t *words() { return array; }
+    const size_t *words() const { return array; }
+    size_t num_words() const { return arrlen; }
+
+    /// ORs other into this bitset a word at a time
+    /// @return the popcount of the result; has_intersection is set if the
+    /// two bitsets shared a bit
+    size_t merge(const dense_bitset &other, bool &has_intersection)
+    {
+        CHECK_EQ(size(), other.size());
+        size_t ret = 0;
+        for (size_t i = 0; i < arrlen; ++i) {
+            has_intersection |= (array[i] & other.array[i]) != 0;
+            array[i] |= other.array[i];
+            ret += __builtin_popcountl(array[i]);
+        }
+        return ret;
+    }
+
     dense_bitset &operator-=(const dense_bitset &other)
     {
         CHECK_EQ(size(), other.size());
@@ -1,12 +1,21 @@
 #include <numeric>
 #include <random>
+#include <queue>
+#include <cstdio>
 
 #include "ebv_partitioner.hpp"
+#include "radix_sort.hpp"
 #include "conversions.hpp"
 
-EbvPartitioner::EbvPartitioner(std::string basefilename, bool need_k_split)
-    : basefilename(basefilename), rd(), gen(rd())
+DECLARE_int32(ebv_run_mb);
+
+EbvPartitioner::EbvPartitioner(std::string basefilename, bool need_k_split, bool out_of_core)
+    : basefilename(basefilename), rd(), gen(rd()), out_of_core(out_of_core)
 {
+    if (out_of_core) {
+        CHECK(!need_k_split) << "ebv_ooc cannot be the split method of FSM";
+        CHECK_EQ(FLAGS_passes, 1) << "-passes is not supported by ebv_ooc";
+    }
     if (need_k_split || FLAGS_write == "none") {
         writer = std::make_unique<EdgepartWriterBase<vid_t, bid_t>>(basefilename);
     } else {
@@ -45,16 +54,20 @@ EbvPartitioner::EbvPartitioner(std::string basefilename, bool need_k_split)
         num_partitions *= FLAGS_k;
     }
 
-    edges.resize(num_edges);
-    fin.read((char *)&edges[0], sizeof(edge_t) * num_edges);
+    if (!out_of_core) {
+        edges.resize(num_edges);
+        fin.read((char *)&edges[0], sizeof(edge_t) * num_edges);
+    }
 
     LOG(INFO) << "constructing...";
 
     is_boundarys.assign(num_partitions, dense_bitset(num_vertices));
     occupied.assign(num_partitions, 0);
-    num_bucket_vertices.assign(num_partitions, 0);
+    vertex_loads.assign(num_partitions);
     avg_edge_cnt = (double)num_edges / FLAGS_p;
-    // edgelist2bucket.assign(num_edges, kInvalidBid);
+    if (need_k_split) {
+        edgelist2bucket.assign(num_edges, kInvalidBid);
+    }
 
     degrees.resize(num_vertices);
     std::ifstream degree_file(degree_name(basefilename), std::ios::binary);
@@ -65,24 +78,175 @@ EbvPartitioner::EbvPartitioner(std::string basefilename, bool need_k_split)
 void EbvPartitioner::split()
 {
     partition_time.start();
+    if (out_of_core) {
+        out_of_core_split();
+        return;
+    }
     // std::shuffle(edges.begin(), edges.end(), rd);
-    sort(edges.begin(), edges.end(), [&](const auto &l, const auto &r) {
-        vid_t lu = l.first, lv = l.second;
-        vid_t ru = r.first, rv = r.second;
-        return degrees[lu] + degrees[lv] < degrees[ru] + degrees[rv];
-    });
+    sort_edges_by_degree_sum();
+
+    if (FLAGS_passes > 1) {
+        edgelist2bucket.assign(num_edges, kInvalidBid);
+        replica_counts.init(num_vertices, num_partitions);
+    }
+    for (pass = 1; pass <= FLAGS_passes; ++pass) {
+        Timer pass_timer;
+        pass_timer.start();
+        if (pass > 1) {
+            is_boundarys.assign(num_partitions, dense_bitset(num_vertices));
+        }
+
+        for (eid_t eid = 0; eid < num_edges; ++eid) {
+            edge_t e = edges[eid];
+            vid_t u = e.first, v = e.second;
+            if (pass > 1) {
+                unassign_edge(edgelist2bucket[eid], u, v);
+            }
+            bid_t bucket = best_scored_partition(u, v, eid); // according to ebv scoring
+            assign_edge(bucket, u, v, eid);
+            if (eid % 50000000 == 0) {
+                LOG(INFO) << "Processing edges " << eid;
+            }
+        }
 
+        pass_timer.stop();
+        if (FLAGS_passes > 1) {
+            LOG(INFO) << "pass " << pass << ": replication factor " << replication_factor()
+                      << ", time " << pass_timer.get_time();
+        }
+    }
+    partition_time.stop();
+
+    total_time.stop();
+    LOG(INFO) << "partition time: " << partition_time.get_time();
+    calculate_stats();
+}
+
+// Orders the edges by the degree sum of their endpoints. The key (vid_t
+// arithmetic, as in the former comparator) is computed once per edge and
+// the (key, edge) pairs are radix sorted, instead of four random degree
+// loads per comparison.
+void EbvPartitioner::sort_edges_by_degree_sum()
+{
+    Timer sort_timer;
+    sort_timer.start();
+    std::vector<keyed_edge_t> keyed(num_edges);
+    vid_t max_key = 0;
+    #pragma omp parallel for num_threads(FLAGS_threads) reduction(max : max_key)
     for (eid_t eid = 0; eid < num_edges; ++eid) {
-        edge_t e = edges[eid];
-        vid_t u = e.first, v = e.second;
+        const edge_t &e = edges[eid];
+        keyed[eid] = {degrees[e.first] + degrees[e.second], e};
+        max_key = std::max(max_key, keyed[eid].key);
+    }
+    std::vector<edge_t>().swap(edges);
+
+    parallel_radix_sort(keyed, [](const keyed_edge_t &k) { return k.key; }, max_key, FLAGS_threads);
+
+    edges.resize(num_edges);
+    #pragma omp parallel for num_threads(FLAGS_threads)
+    for (eid_t eid = 0; eid < num_edges; ++eid) {
+        edges[eid] = keyed[eid].e;
+    }
+    sort_timer.stop();
+    LOG(INFO) << "edge ordering time: " << sort_timer.get_time();
+}
+
+// The degree-sum order without the edge array: the edge list is cut into
+// runs of at most -ebv_run_mb, each radix sorted and written to disk, and
+// the k-way merge of the runs feeds the scorer. Ties are broken by run, so
+// the order is the one of the in-memory (stable) sort.
+void EbvPartitioner::out_of_core_split()
+{
+    auto key_of = [](const keyed_edge_t &k) { return k.key; };
+    // the radix sort needs a second buffer of the same size
+    const size_t run_edges = std::max((size_t)FLAGS_ebv_run_mb * 1024 * 1024 / (2 * sizeof(keyed_edge_t)),
+                                      (size_t)1);
+    std::vector<std::string> runs;
+    {
+        std::vector<keyed_edge_t> run;
+        run.reserve(std::min(run_edges, (size_t)num_edges));
+        vid_t max_key = 0;
+        auto save_run = [&]() {
+            parallel_radix_sort(run, key_of, max_key, FLAGS_threads);
+            std::string run_name = basefilename + ".ebv_run." + std::to_string(runs.size());
+            std::ofstream fout(run_name, std::ios::binary | std::ios::trunc);
+            fout.write((const char *)run.data(), run.size() * sizeof(keyed_edge_t));
+            CHECK(fout.good()) << "failed to write " << run_name;
+            runs.push_back(run_name);
+            run.clear();
+            max_key = 0;
+        };
+
+        EdgeStream stream(binedgelist_name(basefilename), sizeof(num_vertices) + sizeof(num_edges), num_edges);
+        const edge_t *stream_edges;
+        eid_t chunk_size;
+        while ((chunk_size = stream.next(stream_edges)) > 0) {
+            for (eid_t i = 0; i < chunk_size; ++i) {
+                const edge_t &e = stream_edges[i];
+                run.push_back({degrees[e.first] + degrees[e.second], e});
+                max_key = std::max(max_key, run.back().key);
+                if (run.size() == run_edges) {
+                    save_run();
+                }
+            }
+        }
+        if (!run.empty()) {
+            save_run();
+        }
+    }
+    LOG(INFO) << "sorted runs: " << runs.size() << ", edges per run: " << run_edges;
+
+    struct run_reader_t {
+        std::ifstream fin;
+        std::vector<keyed_edge_t> buffer;
+        size_t pos = 0, size = 0;
+
+        bool refill()
+        {
+            fin.read((char *)buffer.data(), buffer.size() * sizeof(keyed_edge_t));
+            size = fin.gcount() / sizeof(keyed_edge_t);
+            pos = 0;
+            return size > 0;
+        }
+        bool advance() { return ++pos < size || refill(); }
+    };
+    // the merge buffers share the budget of the runs
+    const size_t buffer_edges = std::min(std::max(2 * run_edges / std::max(runs.size(), (size_t)1), (size_t)1024),
+                                         std::min(run_edges, (size_t)num_edges));
+    std::vector<run_reader_t> readers(runs.size());
+    using head_t = std::pair<vid_t, size_t>; // (key, run)
+    std::priority_queue<head_t, std::vector<head_t>, std::greater<head_t>> heads;
+    for (size_t r = 0; r < runs.size(); ++r) {
+        readers[r].fin.open(runs[r], std::ios::binary);
+        CHECK(readers[r].fin.is_open()) << "failed to open " << runs[r];
+        readers[r].buffer.resize(buffer_edges);
+        if (readers[r].refill()) {
+            heads.push({readers[r].buffer[0].key, r});
+        }
+    }
+
+    eid_t eid = 0;
+    while (!heads.empty()) {
+        size_t r = heads.top().second;
+        heads.pop();
+        run_reader_t &reader = readers[r];
+        vid_t u = reader.buffer[reader.pos].e.first, v = reader.buffer[reader.pos].e.second;
         bid_t bucket = best_scored_partition(u, v, eid); // according to ebv scoring
         assign_edge(bucket, u, v, eid);
         if (eid % 50000000 == 0) {
             LOG(INFO) << "Processing edges " << eid;
         }
+        ++eid;
+        if (reader.advance()) {
+            heads.push({reader.buffer[reader.pos].key, r});
+        }
+    }
+    CHECK_EQ(eid, num_edges);
+    for (const auto &run_name : runs) {
+        std::remove(run_name.c_str());
     }
-    partition_time.stop();
 
+    partition_time.stop();
     total_time.stop();
     LOG(INFO) << "partition time: " << partition_time.get_time();
     calculate_stats();
@@ -92,8 +256,10 @@ bid_t EbvPartitioner::best_scored_partition(vid_t u, vid_t v, eid_t edge_id)
 {
     double best_score = 1e18;
 	bid_t best_partition = kInvalidBid;
+	// integer average, as the vertex balance term always used
+	double avg_vertex_cnt = vertex_loads.total() / num_partitions;
 	for (bid_t b = 0; b < num_partitions; ++b) {
-		double score = compute_partition_score(u, v, b, edge_id);
+		double score = compute_partition_score(u, v, b, avg_vertex_cnt);
 		if (score < best_score) {
 			best_score = score;
 			best_partition = b;
@@ -105,11 +271,11 @@ bid_t EbvPartitioner::best_scored_partition(vid_t u, vid_t v, eid_t edge_id)
 	return best_partition;
 }
 
-double EbvPartitioner::compute_partition_score(vid_t u, vid_t v, bid_t bucket_id, eid_t edge_id)
+double EbvPartitioner::compute_partition_score(vid_t u, vid_t v, bid_t bucket_id, double avg_vertex_cnt)
 {
 	double su = 0.0, sv = 0.0;
-    bool u_is_boundary = is_boundarys[bucket_id].get(u), 
-        v_is_boundary = is_boundarys[bucket_id].get(v);
+    bool u_is_boundary = has_replica(bucket_id, u),
+        v_is_boundary = has_replica(bucket_id, v);
     if (!u_is_boundary) {
         ++su;
     } 
@@ -118,7 +284,7 @@ double EbvPartitioner::compute_partition_score(vid_t u, vid_t v, bid_t bucket_id
     }
 
     double imbalance = (double)occupied[bucket_id] / avg_edge_cnt
-                    + (double)num_bucket_vertices[bucket_id] / (num_vertices_all_buckets / num_partitions);
+                    + (double)vertex_loads[bucket_id] / avg_vertex_cnt;
 
 	double score = (su + sv) + (imbalance);
 	return score;
@@ -4,6 +4,9 @@
 #include <memory>
 
 #include "dense_bitset.hpp"
+#include "edge_stream.hpp"
+#include "load_tracker.hpp"
+#include "replica_counts.hpp"
 #include "part_writer.hpp"
 #include "ne_graph.hpp"
 #include "partitioner.hpp"
@@ -17,34 +20,71 @@ class EbvPartitioner : public EdgeListEPartitioner
 
     double avg_edge_cnt;
 
-    std::vector<vid_t> num_bucket_vertices;
+    LoadTracker vertex_loads; // number of vertices per bucket
 
     std::unique_ptr<EdgepartWriterBase<vid_t, bid_t>> writer = nullptr;
-    eid_t num_vertices_all_buckets;
+
+    // -passes > 1: replica_counts is the whole current assignment, is_boundarys only the current pass
+    int pass = 1;
+    replica_counts_t replica_counts;
+
+    bool has_replica(bid_t bucket, vid_t vid)
+    {
+        return replica_counts.empty() ? is_boundarys[bucket].get(vid) : replica_counts.has(vid, bucket);
+    }
+
+    void add_replica(bid_t bucket, vid_t vid)
+    {
+        bool new_replica = replica_counts.empty() ? !is_boundarys[bucket].get(vid)
+                                                  : replica_counts.add(vid, bucket);
+        if (new_replica) {
+            vertex_loads.increment(bucket);
+        }
+        is_boundarys[bucket].set_bit_unsync(vid);
+    }
 
     void assign_edge(bid_t bucket, vid_t from, vid_t to, eid_t edge_id)
     {
-        writer->save_edge(from, to, bucket);
-        // edgelist2bucket[edge_id] = bucket;
+        if (pass == FLAGS_passes) {
+            writer->save_edge(from, to, bucket);
+        }
+        if (!edgelist2bucket.empty()) {
+            edgelist2bucket[edge_id] = bucket;
+        }
         ++occupied[bucket];
-        if (!is_boundarys[bucket].get(from)) {
-            ++num_bucket_vertices[bucket];
-            ++num_vertices_all_buckets;
-            is_boundarys[bucket].set_bit_unsync(from);
+        add_replica(bucket, from);
+        add_replica(bucket, to);
+    }
+
+    /// takes the placement of the previous pass out before the edge is re-scored
+    void unassign_edge(bid_t bucket, vid_t from, vid_t to)
+    {
+        --occupied[bucket];
+        if (replica_counts.remove(from, bucket)) {
+            vertex_loads.decrement(bucket);
         }
-        if (!is_boundarys[bucket].get(to)) {
-            ++num_bucket_vertices[bucket];
-            ++num_vertices_all_buckets;
-            is_boundarys[bucket].set_bit_unsync(to);
+        if (replica_counts.remove(to, bucket)) {
+            vertex_loads.decrement(bucket);
         }
     }
 
+    // edge with the degree sum of its endpoints, the EBV order
+    struct keyed_edge_t {
+        vid_t key;
+        edge_t e;
+    };
+
+    bool out_of_core; // ebv_ooc: sorted runs on disk instead of the edge array
+
+    void sort_edges_by_degree_sum();
+    void out_of_core_split();
+
     // returns bucket id where score is best for edge (u,v)
     bid_t best_scored_partition(vid_t u, vid_t v, eid_t edge_id); 
-    double compute_partition_score(vid_t u, vid_t v, bid_t bucket_id, eid_t edge_id);
+    double compute_partition_score(vid_t u, vid_t v, bid_t bucket_id, double avg_vertex_cnt);
 
   public:
-    EbvPartitioner(std::string basefilename, bool need_k_split);
+    EbvPartitioner(std::string basefilename, bool need_k_split, bool out_of_core = false);
     void split();
 };
 
@@ -0,0 +1,163 @@
+#ifndef EDGE_STREAM_HPP
+#define EDGE_STREAM_HPP
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <cstdlib>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "common.hpp"
+
+/* Sequential reader over a range of edge_t in a binary file.
+ * A background thread keeps a ring of aligned buffers filled, so the next
+ * chunk is being read while the caller processes the current one. */
+class EdgeStream
+{
+  private:
+    static const int kNumBuffers = 3;
+    static const size_t kAlignment = 4096;
+
+    std::string filename;
+    int fd = -1;
+    size_t offset;      // byte offset of the first edge
+    eid_t num_edges;    // edges in the range
+    eid_t chunk_edges;  // edges per buffer
+
+    edge_t *buffers[kNumBuffers];
+    eid_t sizes[kNumBuffers];
+
+    // chunks handed over by the reader / given back by the consumer
+    eid_t num_filled = 0, num_released = 0;
+    bool holding = false, stopping = false;
+    std::mutex mtx;
+    std::condition_variable cv_filled, cv_free;
+    std::thread reader;
+
+    void read_loop()
+    {
+        for (eid_t chunk = 0, pos = 0; pos < num_edges; ++chunk) {
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                cv_free.wait(lock, [this] { return stopping || num_filled - num_released < kNumBuffers; });
+                if (stopping) {
+                    return;
+                }
+            }
+            eid_t n = std::min(chunk_edges, num_edges - pos);
+            char *dst = (char *)buffers[chunk % kNumBuffers];
+            size_t bytes = n * sizeof(edge_t), done = 0;
+            off_t at = offset + pos * sizeof(edge_t);
+            while (done < bytes) {
+                ssize_t r = pread(fd, dst + done, bytes - done, at + done);
+                CHECK_GT(r, 0) << "failed to read edges from " << filename;
+                done += r;
+            }
+            pos += n;
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                sizes[chunk % kNumBuffers] = n;
+                ++num_filled;
+            }
+            cv_filled.notify_one();
+        }
+    }
+
+  public:
+    EdgeStream(const std::string &filename, size_t offset, eid_t num_edges,
+               eid_t chunk_edges = FLAGS_stream_chunk)
+        : filename(filename), offset(offset), num_edges(num_edges),
+          chunk_edges(std::max(std::min(chunk_edges, num_edges), (eid_t)1))
+    {
+        fd = open(filename.c_str(), O_RDONLY);
+        CHECK_GE(fd, 0) << "failed to open " << filename;
+        posix_fadvise(fd, offset, num_edges * sizeof(edge_t), POSIX_FADV_SEQUENTIAL);
+
+        size_t bytes = (this->chunk_edges * sizeof(edge_t) + kAlignment - 1) / kAlignment * kAlignment;
+        for (int i = 0; i < kNumBuffers; ++i) {
+            buffers[i] = (edge_t *)std::aligned_alloc(kAlignment, bytes);
+            CHECK(buffers[i] != nullptr) << "failed to allocate " << bytes << " bytes of stream buffer";
+        }
+        reader = std::thread(&EdgeStream::read_loop, this);
+    }
+
+    EdgeStream(const EdgeStream &) = delete;
+    EdgeStream &operator=(const EdgeStream &) = delete;
+
+    ~EdgeStream()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopping = true;
+        }
+        cv_free.notify_one();
+        reader.join();
+        for (int i = 0; i < kNumBuffers; ++i) {
+            std::free(buffers[i]);
+        }
+        close(fd);
+    }
+
+    /// Points chunk at the next batch of edges and returns its size, 0 at the end.
+    /// The batch stays valid until the following call.
+    eid_t next(const edge_t *&chunk)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        if (holding) {
+            ++num_released;
+            holding = false;
+            cv_free.notify_one();
+        }
+        if (num_released * chunk_edges >= num_edges) {
+            return 0;
+        }
+        cv_filled.wait(lock, [this] { return num_filled > num_released; });
+        holding = true;
+        chunk = buffers[num_released % kNumBuffers];
+        return sizes[num_released % kNumBuffers];
+    }
+
+    /// Bytes held by the buffers of a stream with the given chunk size
+    static size_t memory_bytes(eid_t chunk_edges = FLAGS_stream_chunk)
+    {
+        return kNumBuffers * chunk_edges * sizeof(edge_t);
+    }
+};
+
+/* Read-only mapping of a range of edge_t in a binary file, for partitioners
+ * whose threads each walk their own slice of the edges. */
+class EdgeMap
+{
+  private:
+    std::string filename;
+    int fd = -1;
+    size_t length; // mapped bytes, from the start of the file
+    size_t offset;
+    char *base = nullptr;
+
+  public:
+    EdgeMap(const std::string &filename, size_t offset, eid_t num_edges)
+        : filename(filename), length(offset + num_edges * sizeof(edge_t)), offset(offset)
+    {
+        fd = open(filename.c_str(), O_RDONLY);
+        CHECK_GE(fd, 0) << "failed to open " << filename;
+        base = (char *)mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        CHECK(base != MAP_FAILED) << "failed to mmap " << filename;
+        madvise(base, length, MADV_SEQUENTIAL);
+    }
+
+    EdgeMap(const EdgeMap &) = delete;
+    EdgeMap &operator=(const EdgeMap &) = delete;
+
+    ~EdgeMap()
+    {
+        munmap(base, length);
+        close(fd);
+    }
+
+    const edge_t *edges() const { return (const edge_t *)(base + offset); }
+};
+
+#endif
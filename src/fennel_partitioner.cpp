@@ -1,7 +1,9 @@
+#include <omp.h>
 #include <random>
 
 #include "fennel_partitioner.hpp"
 #include "conversions.hpp"
+#include "stream_order.hpp"
 
 template <typename TAdj>
 FennelPartitioner<TAdj>::FennelPartitioner(std::string basefilename, bool need_k_split)
@@ -43,8 +45,10 @@ FennelPartitioner<TAdj>::FennelPartitioner(std::string basefilename, bool need_k
 
     is_boundarys.assign(num_partitions, dense_bitset(num_vertices));
     occupied.assign(num_partitions, 0);
-    w_.assign(num_partitions, 0);
-    // vertex2bucket.assign(num_vertices, kInvalidBid);
+    w_.assign(num_partitions);
+    intra_costs.assign(num_partitions, intra_partition_cost(0));
+    neighbor_buckets.init(num_partitions);
+    vertex2bucket.assign(num_vertices, kInvalidBid);
     // capacity = (double)num_edges * 2 * 1.05 / num_partitions + 1; //will be used to as stopping criterion later
     capacity = (double)num_vertices * 1.1 / num_partitions + 1; // will be used to as stopping criterion later
 
@@ -61,72 +65,183 @@ template <typename TAdj>
 void FennelPartitioner<TAdj>::split()
 {
     partition_time.start();
-    // std::vector<vid_t> order(num_vertices);
-    // std::iota(order.begin(), order.end(), (vid_t)0);
-    // std::mt19937 engine(123);
-    // std::shuffle(order.begin(), order.end(), engine);
-
-    for (vid_t v = 0; v < num_vertices; ++v) {
-        // vid_t vid = order[v];
-        vid_t vid = v;
-        if (v % 5'000'000 == 0) {
-            LOG(INFO) << "Vertex processed " << v;
+    std::vector<vid_t> order = stream_order(graph, FLAGS_order, FLAGS_seed, FLAGS_threads);
+
+    if (FLAGS_threads > 1) {
+        CHECK_EQ(FLAGS_passes, 1) << "-passes is not supported by the parallel Fennel";
+        parallel_split(order);
+    } else {
+        for (pass = 1; pass <= FLAGS_passes; ++pass) {
+            Timer pass_timer;
+            pass_timer.start();
+            for (vid_t v = 0; v < num_vertices; ++v) {
+                vid_t vid = order[v];
+                if (v % 5'000'000 == 0) {
+                    LOG(INFO) << "Vertex processed " << v;
+                }
+                bid_t old_bucket = vertex2bucket[vid]; // kInvalidBid in the first pass
+                if (old_bucket != kInvalidBid) {
+                    vertex2bucket[vid] = kInvalidBid;
+                    is_boundarys[old_bucket].clear_bit_unsync(vid);
+                    w_.decrement(old_bucket);
+                    intra_costs[old_bucket] = intra_partition_cost(w_[old_bucket]);
+                }
+                neighbor_buckets.build(graph[vid], vertex2bucket);
+                if (old_bucket != kInvalidBid) {
+                    // occupied[b] sums, over the vertices of b, the neighbors not yet in b
+                    // when they were placed, so removing the vertex undoes it exactly
+                    occupied[old_bucket] -= graph[vid].size() - neighbor_buckets[old_bucket];
+                }
+                const auto [bucket, additional_edges] = best_scored_partition(vid, neighbor_buckets, w_, intra_costs, gen);
+                assign_vertex(bucket, vid, additional_edges);
+            }
+
+            pass_timer.stop();
+            if (FLAGS_passes > 1) {
+                LOG(INFO) << "pass " << pass << ": edge cut ratio " << edge_cut_ratio()
+                          << ", time " << pass_timer.get_time();
+            }
         }
-        const auto [bucket, additional_edges] = best_scored_partition(vid); // according to ebv scoring
-        assign_vertex(bucket, vid, additional_edges);
     }
 
     partition_time.stop();
     total_time.stop();
     LOG(INFO) << "partition time: " << partition_time.get_time();
+
+    // the vertex partition file is one bucket per line in id order
+    for (vid_t vid = 0; vid < num_vertices; ++vid) {
+        writer.save_vertex(vid, vertex2bucket[vid]);
+    }
     calculate_stats();
 }
 
-// <final bucket, additional edges>
+// Threads take blocks of the stream order and score against the shared
+// vertex2bucket and a private copy of the bucket loads, refreshed from the
+// shared counters every kRefreshInterval vertices, so a thread sees the
+// placements of the others with bounded delay. Buckets may thus overshoot
+// the capacity a little, which a short sequential pass moves back before
+// occupied is recounted exactly.
 template <typename TAdj>
-std::tuple<bid_t, eid_t> FennelPartitioner<TAdj>::best_scored_partition(vid_t vid) 
+void FennelPartitioner<TAdj>::parallel_split(const std::vector<vid_t> &order)
 {
-	double best_score = -1e18;
-	bid_t best_partition = kInvalidBid;
-    eid_t final_additional_edges = 0;
-	for (bid_t b = 0; b < num_partitions; ++b) {
-        if (w_[b] >= capacity)  continue;
-		const auto &[score, additional_edges] = compute_partition_score(vid, b);
-		if (score > best_score) {
-			best_score = score;
-			best_partition = b;
-            final_additional_edges = additional_edges;
-		}
-	}
-    if (best_partition == kInvalidBid) {
-        best_partition = gen() % num_partitions;
-        const auto &[overlap, neighbors_cnt] = overlap_partition_vertex(vid, best_partition);
-        final_additional_edges = neighbors_cnt - overlap;
+    const int num_threads = FLAGS_threads;
+    const vid_t kBlockVertices = 4096;
+    const vid_t kRefreshInterval = 1024;
+    LOG(INFO) << "parallel Fennel with " << num_threads << " threads";
+
+    std::vector<eid_t> shared_w(num_partitions, 0);
+    std::vector<std::mt19937::result_type> seeds(num_threads);
+    for (auto &seed : seeds) {
+        seed = gen();
+    }
+    const vid_t num_blocks = (num_vertices + kBlockVertices - 1) / kBlockVertices;
+
+    #pragma omp parallel num_threads(num_threads)
+    {
+        std::mt19937 local_gen(seeds[omp_get_thread_num()]);
+        BucketHistogram local_buckets;
+        local_buckets.init(num_partitions);
+        std::vector<eid_t> snapshot(num_partitions);
+        LoadTracker local_w;
+        std::vector<double> local_costs(num_partitions);
+
+        vid_t num_local_vertices = 0;
+        #pragma omp for schedule(dynamic, 1)
+        for (vid_t block = 0; block < num_blocks; ++block) {
+            vid_t end = std::min(num_vertices, (block + 1) * kBlockVertices);
+            for (vid_t v = block * kBlockVertices; v < end; ++v, ++num_local_vertices) {
+                if (num_local_vertices % kRefreshInterval == 0) {
+                    for (bid_t b = 0; b < num_partitions; ++b) {
+                        snapshot[b] = __atomic_load_n(&shared_w[b], __ATOMIC_RELAXED);
+                    }
+                    local_w.assign(snapshot);
+                    for (bid_t b = 0; b < num_partitions; ++b) {
+                        local_costs[b] = intra_partition_cost(local_w[b]);
+                    }
+                }
+                vid_t vid = order[v];
+                local_buckets.build(graph[vid], vertex2bucket);
+                bid_t bucket = std::get<0>(best_scored_partition(vid, local_buckets, local_w, local_costs, local_gen));
+
+                __atomic_store_n(&vertex2bucket[vid], bucket, __ATOMIC_RELAXED);
+                is_boundarys[bucket].set_bit(vid);
+                __sync_fetch_and_add(&shared_w[bucket], 1);
+                local_w.increment(bucket);
+                local_costs[bucket] = intra_partition_cost(local_w[bucket]);
+            }
+        }
     }
-	return {best_partition, final_additional_edges};
-}
 
-template <typename TAdj>
-std::tuple<vid_t, vid_t> 
-FennelPartitioner<TAdj>::overlap_partition_vertex(vid_t vid, bid_t bucket_id) 
-{
-    AdjList<AdjEntryVid>& neighbors = graph[vid];
-    vid_t overlap = 0, neighbors_cnt = neighbors.size();
-    for (vid_t i = 0; i < neighbors.size(); ++i) {
-        vid_t uid = neighbors[i].vid;
-        if (is_boundarys[bucket_id].get(uid)) {
-            ++overlap;
+    w_.assign(shared_w);
+    for (bid_t b = 0; b < num_partitions; ++b) {
+        intra_costs[b] = intra_partition_cost(w_[b]);
+    }
+    // move the latest vertices of overfull buckets to the best bucket with room
+    vid_t num_moved = 0;
+    for (vid_t v = num_vertices; v-- > 0 && w_.max() > capacity;) {
+        vid_t vid = order[v];
+        bid_t old_bucket = vertex2bucket[vid];
+        if (w_[old_bucket] <= capacity) {
+            continue;
+        }
+        vertex2bucket[vid] = kInvalidBid;
+        is_boundarys[old_bucket].clear_bit_unsync(vid);
+        w_.decrement(old_bucket);
+        intra_costs[old_bucket] = intra_partition_cost(w_[old_bucket]);
+        neighbor_buckets.build(graph[vid], vertex2bucket);
+        assign_vertex(std::get<0>(best_scored_partition(vid, neighbor_buckets, w_, intra_costs, gen)), vid, 0);
+        ++num_moved;
+    }
+    LOG(INFO) << "vertices moved off overfull buckets: " << num_moved;
+
+    // occupied[b] is the degree sum of b minus its internal edges, each
+    // counted once at its larger endpoint
+    std::fill(occupied.begin(), occupied.end(), 0);
+    #pragma omp parallel num_threads(num_threads)
+    {
+        std::vector<eid_t> local_occupied(num_partitions, 0);
+        #pragma omp for schedule(dynamic, kBlockVertices)
+        for (vid_t vid = 0; vid < num_vertices; ++vid) {
+            bid_t bucket = vertex2bucket[vid];
+            auto &neighbors = graph[vid];
+            vid_t internal = 0;
+            for (vid_t i = 0; i < neighbors.size(); ++i) {
+                vid_t uid = neighbors[i].vid;
+                if (uid < vid && vertex2bucket[uid] == bucket) {
+                    ++internal;
+                }
+            }
+            local_occupied[bucket] += neighbors.size() - internal;
+        }
+        #pragma omp critical
+        for (bid_t b = 0; b < num_partitions; ++b) {
+            occupied[b] += local_occupied[b];
         }
     }
-    return {overlap, neighbors_cnt};
 }
 
+// <final bucket, additional edges>
 template <typename TAdj>
-std::tuple<double, size_t> 
-FennelPartitioner<TAdj>::compute_partition_score(vid_t vid, bid_t bucket_id) 
+std::tuple<bid_t, eid_t> FennelPartitioner<TAdj>::best_scored_partition(vid_t vid, const BucketHistogram &histogram,
+                                                                      const LoadTracker &loads,
+                                                                      const std::vector<double> &costs,
+                                                                      std::mt19937 &engine) 
 {
-    double intra_partition_score = intra_partition_cost(w_[bucket_id]);
-    const auto &[overlap, neighbors_cnt] = overlap_partition_vertex(vid, bucket_id);
-    double inter_partition_score = overlap;
-	return {inter_partition_score - intra_partition_score, neighbors_cnt - overlap};
+	double best_score = -1e18;
+	bid_t best_partition = kInvalidBid;
+    // once every bucket is full, no need to score them
+    if (loads.min() < capacity) {
+        for (bid_t b = 0; b < num_partitions; ++b) {
+            if (loads[b] >= capacity)  continue;
+            double score = (double)histogram[b] - costs[b];
+            if (score > best_score) {
+                best_score = score;
+                best_partition = b;
+            }
+        }
+    }
+    if (best_partition == kInvalidBid) {
+        best_partition = engine() % num_partitions;
+    }
+	return {best_partition, graph[vid].size() - histogram[best_partition]};
 }
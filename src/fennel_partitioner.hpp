@@ -3,7 +3,9 @@
 
 #include <random>
 
+#include "bucket_histogram.hpp"
 #include "dense_bitset.hpp"
+#include "load_tracker.hpp"
 #include "part_writer.hpp"
 #include "ne_graph.hpp"
 #include "graph.hpp"
@@ -26,7 +28,9 @@ class FennelPartitioner : public AdjListVPartitioner<TAdj>
     using AdjListVPartitioner<TAdj>::is_boundarys;
     using AdjListVPartitioner<TAdj>::edges;
     using AdjListVPartitioner<TAdj>::degrees;
+    using AdjListVPartitioner<TAdj>::vertex2bucket;
     using AdjListVPartitioner<TAdj>::calculate_stats;
+    using AdjListVPartitioner<TAdj>::edge_cut_ratio;
 
     // // use mmap for file input
     // int fin;
@@ -35,10 +39,9 @@ class FennelPartitioner : public AdjListVPartitioner<TAdj>
 
     Graph<AdjEntryVid> graph;
 
-    std::vector<eid_t> w_;
+    LoadTracker w_; // vertices per bucket
     VertexpartWriter<vid_t, bid_t> writer;
     
-    // std::vector<bid_t> vertex2bucket;
     eid_t capacity;
     // Parameters
     double gamma = 1.5;
@@ -48,21 +51,28 @@ class FennelPartitioner : public AdjListVPartitioner<TAdj>
         return alpha * gamma * pow(sz, gamma - 1.0);
     }
 
-    std::tuple<vid_t, vid_t> overlap_partition_vertex(vid_t vid, bid_t bucket_id);
+    std::vector<double> intra_costs;  // intra_partition_cost(w_[b]), refreshed when w_[b] changes
+    BucketHistogram neighbor_buckets; // neighbors per bucket of the vertex being placed
+
+    int pass = 1; // -passes > 1 restreams with the previous placement as prior
 
     void assign_vertex(bid_t bucket, vid_t vid, eid_t additional_edges)
     {
-        writer.save_vertex(vid, bucket);
         is_boundarys[bucket].set_bit_unsync(vid);
-        // vertex2bucket[vid] = bucket;
+        vertex2bucket[vid] = bucket;
         // w_[bucket] += degrees[vid];
-        w_[bucket] += 1;
+        w_.increment(bucket);
+        intra_costs[bucket] = intra_partition_cost(w_[bucket]);
         occupied[bucket] += additional_edges;
     }
 
-    /// @return <final bucket, additional edges> whose score is best for vertex v
-    std::tuple<bid_t, eid_t> best_scored_partition(vid_t v); 
-    std::tuple<double, eid_t> compute_partition_score(vid_t vid, bid_t bucket_id);
+    /// @return <final bucket, additional edges> whose score is best for vertex v,
+    /// scored from its neighbor histogram and the given loads and their costs
+    std::tuple<bid_t, eid_t> best_scored_partition(vid_t v, const BucketHistogram &histogram,
+                                                   const LoadTracker &loads, const std::vector<double> &costs,
+                                                   std::mt19937 &engine);
+
+    void parallel_split(const std::vector<vid_t> &order);
 
   public:
     FennelPartitioner(std::string basefilename, bool need_k_split);
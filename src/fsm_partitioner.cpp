@@ -1,29 +1,45 @@
 #include <queue>
+#include <omp.h>
 
 #include "fsm_partitioner.hpp"
 #include "ne_partitioner.hpp"
 #include "hep_partitioner.hpp"
-// #include "hdrf_partitioner.hpp"
-// #include "dbh_partitioner.hpp"
-// #include "ebv_partitioner.hpp"
+#include "hdrf_partitioner.hpp"
+#include "dbh_partitioner.hpp"
+#include "ebv_partitioner.hpp"
 #include "conversions.hpp"
 DECLARE_int32(k);
 DECLARE_bool(fastmerge);
+DECLARE_double(refine_time);
+DECLARE_bool(save_split);
+DECLARE_bool(merge_only);
+DECLARE_string(fsm_replicas);
+DECLARE_string(verify);
+
+/* -save_split artifact, each section 8-byte aligned so it can be mapped:
+ *   split_header_t
+ *   occupied of the sub-buckets     num_buckets x uint64_t
+ *   replica bitsets                 num_buckets x words
+ *   sub-bucket of every edge        num_edges x bid_t, padded
+ *   the edges                       num_edges x edge_t, if has_edges
+ * The edges are only kept when the split did not leave them in the order
+ * of the binedgelist (hep and ebv). */
+const uint64_t kSplitArtifactMagic = 0x3174696c70736d66; // "fmsplit1"
+struct split_header_t {
+    uint64_t magic, bid_bytes, num_vertices, num_edges, num_buckets, has_edges;
+};
 
 FsmPartitioner::FsmPartitioner(std::string basefilename)
     : basefilename(basefilename)
 {
-    if (FLAGS_write == "none") {
-        writer = std::make_unique<EdgepartWriterBase<vid_t, bid_t>>(basefilename);
-    } else {
-        if (FLAGS_write == "onefile") {
-            writer = std::make_unique<EdgepartWriterOnefile<vid_t, bid_t>>(basefilename);
-        } else if (FLAGS_write == "multifile") {
-            writer = std::make_unique<EdgepartWriterMultifile<vid_t, bid_t>>(basefilename);
-        }
-    }
+    open_writer(0);
     num_partitions = FLAGS_p;
     k = FLAGS_k;
+    std::vector<int> levels = partition_levels();
+    for (size_t level = 1; level < levels.size(); ++level) {
+        CHECK(levels[level] > 0 && levels[level] < levels[level - 1] && levels[level - 1] % levels[level] == 0)
+            << "-levels entry " << levels[level] << " does not divide " << levels[level - 1];
+    }
     split_partitioner = nullptr;
     LOG(INFO) << "k = " << (uint32_t)k
                 << ", num_partitions = " << (uint32_t)num_partitions;
@@ -31,36 +47,295 @@ FsmPartitioner::FsmPartitioner(std::string basefilename)
     CHECK_GT(kInvalidBid, k * num_partitions);
 
     split_method = FLAGS_method == "fsm" ? "ne" : FLAGS_method.substr(4);
+    hep_edges = split_method == "hep" && !FLAGS_merge_only;
+    replica_lists = FLAGS_fsm_replicas == "lists";
+    CHECK(FLAGS_verify == "none" || FLAGS_verify == "fast" || FLAGS_verify == "full")
+        << "unknown -verify: " << FLAGS_verify;
+    CHECK(replica_lists || FLAGS_fsm_replicas == "bitset") << "unknown -fsm_replicas: " << FLAGS_fsm_replicas;
+    if (FLAGS_merge_only) {
+        CHECK(!FLAGS_save_split) << "-merge_only already reads a saved split";
+        load_split();
+        occupied.assign(num_partitions, 0);
+        return;
+    }
     if (split_method == "ne") {
         split_partitioner = std::make_unique<NePartitioner<adj_with_bid_t>>(FLAGS_filename, true);
     } else if (split_method == "hep") {
         split_partitioner = std::make_unique<HepPartitioner<adj_with_bid_t>>(FLAGS_filename, true);
+    } else if (split_method == "dbh") {
+        split_partitioner = std::make_unique<DbhPartitioner>(FLAGS_filename, true);
+    } else if (split_method == "ebv") {
+        split_partitioner = std::make_unique<EbvPartitioner>(FLAGS_filename, true);
+    } else if (split_method == "hdrf") {
+        split_partitioner = std::make_unique<HdrfPartitioner>(FLAGS_filename, true);
+    } else {
+        LOG(FATAL) << "Unknown split method: " << split_method;
     }
-    // else if (split_method == "dbh") {
-    //     split_partitioner = std::make_unique<DbhPartitioner>(FLAGS_filename, true);
-    // } else if (split_method == "ebv") {
-    //     split_partitioner = std::make_unique<EbvPartitioner>(FLAGS_filename, true);
-    // } else if (split_method == "hdrf") {
-    //     split_partitioner = std::make_unique<HdrfPartitioner>(FLAGS_filename, true);
-    // } else {
-    //     LOG(ERROR) << "Unknown split method!";
-    // }
 
     num_vertices = split_partitioner->num_vertices;
     num_edges = split_partitioner->num_edges;
 
-    bucket_info.assign(k * num_partitions, BucketInfo(num_vertices));
+    // the bitsets are moved in from the split partitioner
+    bucket_info.assign(k * num_partitions, BucketInfo(0));
     for (bid_t i = 0; i < k * num_partitions; ++i) bucket_info[i].old_id = i;
 
     edgelist2bucket.assign(num_edges, kInvalidBid);
     occupied.assign(num_partitions, 0);
 };
 
+void FsmPartitioner::open_writer(int level)
+{
+    if (FLAGS_write == "none") {
+        writer = std::make_unique<EdgepartWriterBase<vid_t, bid_t>>(basefilename);
+    } else {
+        if (FLAGS_write == "onefile") {
+            writer = std::make_unique<EdgepartWriterOnefile<vid_t, bid_t>>(basefilename, level);
+        } else if (FLAGS_write == "multifile") {
+            writer = std::make_unique<EdgepartWriterMultifile<vid_t, bid_t>>(basefilename, level);
+        }
+    }
+}
+
+// The bitsets are only counted, each freed right after, so the lists never
+// coexist with them: the lists are filled from the edges. The list of a
+// vertex is an open-addressing table of exactly its replica count, every
+// endpoint probing for the bucket of the edge from bucket % length, so a
+// vertex in all buckets finds it at once. The replicas of a bucket are
+// exactly the endpoints of its edges, so every slot is filled, and the
+// lists are sorted afterwards.
+void FsmPartitioner::bitsets_to_lists()
+{
+    Timer lists_timer;
+    lists_timer.start();
+    const bid_t num_buckets = num_partitions * k;
+    replica_offsets.assign(num_vertices + 1, 0);
+    for (bid_t b = 0; b < num_buckets; ++b) {
+        CHECK_EQ(bucket_info[b].old_id, b);
+        for (size_t v : bucket_info[b].is_mirror) {
+            ++replica_offsets[v + 1];
+        }
+        bucket_info[b].is_mirror = dense_bitset();
+    }
+    for (vid_t v = 0; v < num_vertices; ++v) {
+        replica_offsets[v + 1] += replica_offsets[v];
+    }
+    replica_buckets.assign(replica_offsets[num_vertices], kInvalidBid);
+    bid_t *lists = replica_buckets.data();
+    parallel_for_each_edge([&](bid_t &edge_bucket, vid_t u, vid_t v) {
+        for (vid_t w : {u, v}) {
+            bid_t *list = lists + replica_offsets[w];
+            const eid_t length = replica_offsets[w + 1] - replica_offsets[w];
+            eid_t probes = 0;
+            for (eid_t i = length ? edge_bucket % length : 0; probes < length; ++probes, i = i + 1 == length ? 0 : i + 1) {
+                bid_t seen = __atomic_load_n(list + i, __ATOMIC_RELAXED);
+                if (seen == kInvalidBid) {
+                    seen = __sync_val_compare_and_swap(list + i, kInvalidBid, edge_bucket);
+                    if (seen == kInvalidBid) {
+                        break;
+                    }
+                }
+                if (seen == edge_bucket) {
+                    break;
+                }
+            }
+            CHECK_LT(probes, length) << "vertex " << w << " has an edge in bucket " << (uint32_t)edge_bucket
+                                     << " without a replica there";
+        }
+    });
+    vid_t unfilled = 0;
+    #pragma omp parallel for num_threads(FLAGS_threads) schedule(dynamic, 4096) reduction(+ : unfilled)
+    for (vid_t v = 0; v < num_vertices; ++v) {
+        std::sort(lists + replica_offsets[v], lists + replica_offsets[v + 1]);
+        unfilled += replica_offsets[v] != replica_offsets[v + 1] && lists[replica_offsets[v + 1] - 1] == kInvalidBid;
+    }
+    CHECK_EQ(unfilled, 0) << "vertices with a replica in a bucket without any of their edges";
+    lists_timer.stop();
+    LOG(INFO) << "replica lists: " << replica_buckets.size() << " replicas, time: " << lists_timer.get_time();
+}
+
+// relabels every list by new_id, then sorts and deduplicates them in
+// parallel, the duplicates left at the end overwritten by kInvalidBid, and
+// compacts them in place in one pass
+void FsmPartitioner::relabel_lists(const std::vector<bid_t> &new_id)
+{
+    #pragma omp parallel for num_threads(FLAGS_threads) schedule(dynamic, 4096)
+    for (vid_t v = 0; v < num_vertices; ++v) {
+        auto begin = replica_buckets.begin() + replica_offsets[v], end = replica_buckets.begin() + replica_offsets[v + 1];
+        for (auto it = begin; it != end; ++it) {
+            *it = new_id[*it];
+        }
+        std::sort(begin, end);
+        std::fill(std::unique(begin, end), end, kInvalidBid);
+    }
+    eid_t size = 0;
+    for (vid_t v = 0; v < num_vertices; ++v) {
+        eid_t begin = replica_offsets[v];
+        replica_offsets[v] = size;
+        for (eid_t i = begin; i < replica_offsets[v + 1] && replica_buckets[i] != kInvalidBid; ++i) {
+            replica_buckets[size++] = replica_buckets[i];
+        }
+    }
+    replica_offsets[num_vertices] = size;
+    replica_buckets.resize(size);
+}
+
+std::vector<vid_t> FsmPartitioner::list_bucket_sizes(size_t num_buckets) const
+{
+    std::vector<vid_t> sizes(num_buckets, 0);
+    for (bid_t b : replica_buckets) {
+        ++sizes[b];
+    }
+    return sizes;
+}
+
+// every vertex has a replica: a list entry, or a bit in the OR of the partitions
+bool FsmPartitioner::all_vertices_assigned()
+{
+    if (replica_lists) {
+        for (vid_t vid = 0; vid < num_vertices; ++vid) {
+            if (replica_offsets[vid] == replica_offsets[vid + 1]) {
+                return false;
+            }
+        }
+        return true;
+    }
+    const size_t num_words = bucket_info[0].is_mirror.num_words();
+    size_t covered = 0;
+    #pragma omp parallel for num_threads(FLAGS_threads) reduction(+ : covered)
+    for (size_t w = 0; w < num_words; ++w) {
+        size_t word = 0;
+        for (bid_t b = 0; b < num_partitions; ++b) {
+            word |= bucket_info[b].is_mirror.words()[w];
+        }
+        covered += __builtin_popcountl(word);
+    }
+    return covered == num_vertices;
+}
+
+void FsmPartitioner::save_split()
+{
+    Timer save_timer;
+    save_timer.start();
+    const bid_t num_buckets = num_partitions * k;
+    split_header_t header{kSplitArtifactMagic, sizeof(bid_t), num_vertices, num_edges, num_buckets,
+                          split_method == "hep" || split_method == "ebv"};
+    std::string filename = split_artifact_name(basefilename);
+    std::ofstream fout(filename, std::ios::binary | std::ios::trunc);
+    fout.write((const char *)&header, sizeof(header));
+    for (bid_t b = 0; b < num_buckets; ++b) {
+        uint64_t sub_occupied = bucket_info[b].occupied;
+        fout.write((const char *)&sub_occupied, sizeof(sub_occupied));
+    }
+    for (bid_t b = 0; b < num_buckets; ++b) {
+        const dense_bitset &is_mirror = bucket_info[b].is_mirror;
+        fout.write((const char *)is_mirror.words(), is_mirror.num_words() * sizeof(size_t));
+    }
+    const uint64_t padding = 0;
+    const size_t padding_bytes = (8 - num_edges * sizeof(bid_t) % 8) % 8;
+    if (hep_edges) {
+        // HEP keeps most edges in its adjacency lists: they are streamed into
+        // both sections at once, the edges through a second stream positioned
+        // past the buckets
+        std::ofstream edge_out(filename, std::ios::binary | std::ios::in | std::ios::out);
+        edge_out.seekp(fout.tellp() + (std::streamoff)(num_edges * sizeof(bid_t) + padding_bytes));
+        const size_t block_edges = 1 << 16;
+        std::vector<bid_t> bucket_block;
+        std::vector<edge_t> edge_block;
+        bucket_block.reserve(block_edges);
+        edge_block.reserve(block_edges);
+        auto write_blocks = [&]() {
+            fout.write((const char *)bucket_block.data(), bucket_block.size() * sizeof(bid_t));
+            edge_out.write((const char *)edge_block.data(), edge_block.size() * sizeof(edge_t));
+            bucket_block.clear();
+            edge_block.clear();
+        };
+        eid_t saved_edges = iterate_edges([&](bid_t &edge_bucket, const vid_t &u, const vid_t &v) {
+            bucket_block.push_back(edge_bucket);
+            edge_block.emplace_back(u, v);
+            if (edge_block.size() == block_edges) {
+                write_blocks();
+            }
+        });
+        write_blocks();
+        CHECK_EQ(saved_edges, num_edges);
+        fout.write((const char *)&padding, padding_bytes);
+        CHECK(edge_out.good()) << "failed to write " << filename;
+    } else {
+        CHECK_EQ(edgelist2bucket.size(), num_edges);
+        fout.write((const char *)edgelist2bucket.data(), num_edges * sizeof(bid_t));
+        fout.write((const char *)&padding, padding_bytes);
+        if (header.has_edges) {
+            fout.write((const char *)edges.data(), num_edges * sizeof(edge_t));
+        }
+    }
+    CHECK(fout.good()) << "failed to write " << filename;
+    save_timer.stop();
+    LOG(INFO) << "saved the split to " << filename << ", time: " << save_timer.get_time();
+}
+
+void FsmPartitioner::load_split()
+{
+    std::string filename = split_artifact_name(basefilename);
+    int fd = open(filename.c_str(), O_RDONLY);
+    CHECK_GE(fd, 0) << "failed to open " << filename << ", run with -save_split first";
+    struct stat st;
+    fstat(fd, &st);
+    size_t length = st.st_size;
+    CHECK_GE(length, sizeof(split_header_t)) << filename << " is not a saved split";
+    const char *base = (const char *)mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    CHECK(base != MAP_FAILED) << "failed to mmap " << filename;
+
+    const split_header_t header = *(const split_header_t *)base;
+    CHECK_EQ(header.magic, kSplitArtifactMagic) << filename << " is not a saved split";
+    CHECK_EQ(header.bid_bytes, sizeof(bid_t)) << "the split was saved by the other bucket id width (main / main_wide)";
+    const bid_t num_buckets = num_partitions * k;
+    CHECK_EQ(header.num_buckets, num_buckets) << "the split was saved with other -p or -k";
+    // the edge buckets index the binedgelist, which may have been rebuilt since
+    std::ifstream fin(binedgelist_name(basefilename), std::ios::binary);
+    CHECK(fin.is_open()) << "failed to open " << binedgelist_name(basefilename);
+    vid_t graph_vertices;
+    eid_t graph_edges;
+    fin.read((char *)&graph_vertices, sizeof(graph_vertices));
+    fin.read((char *)&graph_edges, sizeof(graph_edges));
+    CHECK(fin.good()) << binedgelist_name(basefilename) << " is truncated";
+    CHECK_EQ(header.num_vertices, graph_vertices) << "the split was saved for another graph";
+    CHECK_EQ(header.num_edges, graph_edges) << "the split was saved for another graph";
+    num_vertices = header.num_vertices;
+    num_edges = header.num_edges;
+    LOG(INFO) << "num_vertices: " << num_vertices << ", num_edges: " << num_edges;
+
+    bucket_info.assign(num_buckets, BucketInfo(num_vertices));
+    const char *pos = base + sizeof(header);
+    for (bid_t b = 0; b < num_buckets; ++b) {
+        bucket_info[b].old_id = b;
+        bucket_info[b].occupied = ((const uint64_t *)pos)[b];
+    }
+    pos += num_buckets * sizeof(uint64_t);
+    for (bid_t b = 0; b < num_buckets; ++b) {
+        dense_bitset &is_mirror = bucket_info[b].is_mirror;
+        memcpy(is_mirror.words(), pos, is_mirror.num_words() * sizeof(size_t));
+        pos += is_mirror.num_words() * sizeof(size_t);
+    }
+    edgelist2bucket.assign((const bid_t *)pos, (const bid_t *)pos + num_edges);
+    pos += (num_edges * sizeof(bid_t) + 7) / 8 * 8;
+    if (header.has_edges) {
+        edges.assign((const edge_t *)pos, (const edge_t *)pos + num_edges);
+        pos += num_edges * sizeof(edge_t);
+    }
+    CHECK_EQ((size_t)(pos - base), length) << filename << " is truncated or corrupt";
+    munmap((void *)base, length);
+    close(fd);
+}
+
 void FsmPartitioner::merge()
 {
     size_t max_part_vertice_cnt = 0, all_part_vertice_cnt = 0; 
+    std::vector<vid_t> list_sizes;
+    if (replica_lists) {
+        list_sizes = list_bucket_sizes(num_partitions * k);
+    }
     for (bid_t b = 0; b < num_partitions * k; ++b) {
-        bucket_info[b].replicas = bucket_info[b].is_mirror.popcount();
+        bucket_info[b].replicas = replica_lists ? list_sizes[bucket_info[b].old_id] : bucket_info[b].is_mirror.popcount();
         max_part_vertice_cnt = std::max(max_part_vertice_cnt, bucket_info[b].replicas);
         all_part_vertice_cnt += bucket_info[b].replicas;
     }
@@ -85,13 +360,50 @@ void FsmPartitioner::merge()
     });
 
 
+    mp.clear();
     curr_bucket_id = 0;
     std::unordered_map<bid_t, bid_t> valid_bucket;  // < old bucket, new bucket >
 
+    // read before the merges OR the sub-buckets into the group heads
+    ReplicaOverlap overlap;
+    if (replica_lists || !FLAGS_fastmerge || FLAGS_refine_time > 0) {
+        Timer overlap_timer;
+        overlap_timer.start();
+        if (replica_lists) {
+            // the overlap takes the lists, with the sub-buckets by position in bucket_info
+            std::vector<bid_t> position_of(num_partitions * k);
+            for (bid_t b = 0; b < num_partitions * k; ++b) {
+                position_of[bucket_info[b].old_id] = b;
+            }
+            relabel_lists(position_of);
+            overlap.build(std::move(replica_offsets), std::move(replica_buckets), num_partitions * k,
+                          num_partitions, FLAGS_threads);
+        } else {
+            std::vector<const dense_bitset *> sub_buckets;
+            for (bid_t b = 0; b < num_partitions * k; ++b) {
+                sub_buckets.push_back(&bucket_info[b].is_mirror);
+            }
+            overlap.build(sub_buckets, num_partitions, FLAGS_threads);
+        }
+        overlap_timer.stop();
+        LOG(INFO) << "replica overlap time: " << overlap_timer.get_time();
+    }
+
     if (FLAGS_fastmerge) {
-        valid_bucket = fast_merge();
+        valid_bucket = fast_merge(overlap);
     } else {
-        valid_bucket = precise_merge();
+        valid_bucket = precise_merge(overlap);
+    }
+    if (FLAGS_refine_time > 0) {
+        refine_merge(overlap, valid_bucket);
+    }
+    if (replica_lists) {
+        overlap.release_lists(replica_offsets, replica_buckets);
+        std::vector<bid_t> final_of(num_partitions * k);
+        for (bid_t b = 0; b < num_partitions * k; ++b) {
+            final_of[b] = valid_bucket.at(bucket_info[b].old_id);
+        }
+        relabel_lists(final_of);
     }
     for (bid_t b = 0; b < num_partitions * k; ++b) 
         DLOG(INFO)   << "Bucket_info " << bucket_info[b].old_id 
@@ -115,27 +427,24 @@ void FsmPartitioner::merge()
     }
     bucket_info.shrink_to_fit();
 
-    eid_t curr_assigned_edges;
-    if (split_method == "hep") {
-        curr_assigned_edges = rearrange_edge_hybrid(valid_bucket);
-    } else {
-        curr_assigned_edges = rearrange_edge(edges, valid_bucket);
+    // the edges move to their partitions in the final pass of save_partition
+    final_bucket.assign(kMaxBuckets, kInvalidBid);
+    for (const auto &[old_bucket, new_bucket] : valid_bucket) {
+        final_bucket[old_bucket] = new_bucket;
     }
-    
-    assigned_edges += curr_assigned_edges;
 }
 
-std::unordered_map<bid_t, bid_t> FsmPartitioner::fast_merge()
+std::unordered_map<bid_t, bid_t> FsmPartitioner::fast_merge(ReplicaOverlap &overlap)
 {
     std::unordered_map<bid_t, bid_t> valid_bucket;  // < old bucket, new bucket >
     
     // < mirror_cnt, partitions_inside, index_in_bucket_info, old_id >
     using bucket_item = std::tuple<vid_t, bid_t, bid_t, bid_t>;
     std::priority_queue<bucket_item, std::vector<bucket_item>, std::greater<bucket_item>> pq;  
-    for (bid_t b = 0; b < FLAGS_p; ++b) {
+    for (bid_t b = 0; b < num_partitions; ++b) {
         pq.emplace(0, 0, b, b);
     }
-    for (bid_t b = 0; b < FLAGS_p * FLAGS_k; ++b) {
+    for (bid_t b = 0; b < num_partitions * k; ++b) {
         auto &[is_mirror, occupied, old_id, replicas, is_chosen] = bucket_info[b];
         auto [mirror_cnt, partitions_inside, parent_bucket, parent_old_id] = pq.top();
         pq.pop();
@@ -143,14 +452,20 @@ std::unordered_map<bid_t, bid_t> FsmPartitioner::fast_merge()
             parent_old_id = get_final_bucket(old_id);
             pq.emplace(replicas, partitions_inside + 1, b, parent_old_id);
             is_chosen = true;
+            if (replica_lists) {
+                overlap.add_to_group(parent_old_id, b);
+            }
         } else {
             bool has_intersection = false;
-            size_t new_vertice_cnt = merge_bucket(parent_bucket, b, has_intersection);
+            size_t new_vertice_cnt = merge_bucket(overlap, parent_old_id, parent_bucket, b, has_intersection);
+            if (replica_lists) {
+                overlap.add_to_group(parent_old_id, b);
+            }
             if (!has_intersection) { 
                 std::cerr << "No intersection betwenn bucket " << b << " and " << parent_bucket << '\n';
                 // exit(1);
             }
-            if (partitions_inside + 1 < FLAGS_k) {
+            if (partitions_inside + 1 < k) {
                 pq.emplace(new_vertice_cnt, partitions_inside + 1, parent_bucket, parent_old_id);
             }
         }
@@ -159,59 +474,55 @@ std::unordered_map<bid_t, bid_t> FsmPartitioner::fast_merge()
     return valid_bucket;
 }
 
-std::unordered_map<bid_t, bid_t> FsmPartitioner::precise_merge()
+// every merge is decided from the replica overlaps; the bitsets are only
+// OR-ed into the head of each group
+std::unordered_map<bid_t, bid_t> FsmPartitioner::precise_merge(ReplicaOverlap &overlap)
 {
     std::unordered_map<bid_t, bid_t> valid_bucket;  // < old bucket, new bucket >
 
-    // < mirror_cnt, partitions_inside, index_in_bucket_info, old_id >
-    using bucket_item = std::tuple<vid_t, bid_t, bid_t, bid_t>;
-    std::vector<bucket_item> final_bucket;
-    for (bid_t b = 0; b < num_partitions; ++b) {
-        final_bucket.emplace_back(0, 0, b, b);
-    }
-    auto compute_new_bucket_size = [&](bid_t bid_a, bid_t bid_b) {
-        const auto &is_mirror_a = bucket_info[bid_a].is_mirror, &is_mirror_b = bucket_info[bid_b].is_mirror;
-        dense_bitset new_bucket = is_mirror_a | is_mirror_b;
-        return new_bucket.popcount();
+    struct group_t {
+        bid_t num_members = 0;
+        bid_t head = kInvalidBid;   // first member, its bitset collects the union
+        bid_t final_id = kInvalidBid;
     };
+    std::vector<group_t> groups(num_partitions);
 
     for (bid_t b = 0; b < num_partitions * k; ++b) {
         auto &[is_mirror, occupied, old_id, replicas, is_chosen] = bucket_info[b];
 
-        bid_t best_final_bucket = kInvalidBid;
+        bid_t best_group = kInvalidBid;
         size_t min_size_after_merge = std::numeric_limits<size_t>::max();
 
-        for (bid_t fb = 0; fb < final_bucket.size(); ++fb) {
-            auto [mirror_cnt, partitions_inside, parent_bucket, parent_old_id] = final_bucket[fb];
-            if (partitions_inside == FLAGS_k) continue;
-            if (partitions_inside == 0) {
-                best_final_bucket = fb;
+        for (bid_t g = 0; g < num_partitions; ++g) {
+            if (groups[g].num_members == k) continue;
+            if (groups[g].num_members == 0) {
+                best_group = g;
                 break;
             }
-            size_t new_size_after_merge = compute_new_bucket_size(parent_bucket, b);
+            size_t new_size_after_merge = overlap.union_size(g, b);
             if (min_size_after_merge > new_size_after_merge) {
                 min_size_after_merge = new_size_after_merge;
-                best_final_bucket = fb;
+                best_group = g;
             }
         }
-        CHECK_NE(best_final_bucket, kInvalidBid);
+        CHECK_NE(best_group, kInvalidBid);
 
-        auto [mirror_cnt, partitions_inside, parent_bucket, parent_old_id] = final_bucket[best_final_bucket];
-        if (partitions_inside == 0) {
-            parent_old_id = get_final_bucket(old_id);
-            final_bucket[best_final_bucket] = {replicas, partitions_inside + 1, b, parent_old_id};
+        group_t &group = groups[best_group];
+        if (group.num_members == 0) {
+            group.head = b;
+            group.final_id = get_final_bucket(old_id);
             is_chosen = true;
         } else {
             bool has_intersection = false;
-            size_t new_vertice_cnt = merge_bucket(parent_bucket, b, has_intersection);
+            size_t new_vertice_cnt = merge_bucket(overlap, best_group, group.head, b, has_intersection);
             if (!has_intersection) { 
-                std::cerr << "No intersection betwenn bucket " << b << " and " << parent_bucket << '\n';
-                // exit(1);
+                std::cerr << "No intersection betwenn bucket " << b << " and " << group.head << '\n';
             }
-
-            final_bucket[best_final_bucket] = {new_vertice_cnt, partitions_inside + 1, parent_bucket, parent_old_id};
+            CHECK_EQ(new_vertice_cnt, overlap.union_size(best_group, b));
         }
-        valid_bucket.emplace(old_id, parent_old_id);
+        overlap.add_to_group(best_group, b);
+        ++group.num_members;
+        valid_bucket.emplace(old_id, group.final_id);
     }
     return valid_bucket;
 }
@@ -222,6 +533,15 @@ void FsmPartitioner::calculate_stats()
         return l.old_id < r.old_id;
     });
 
+    if (replica_lists) {
+        occupied.resize(num_partitions);
+        for (bid_t b = 0; b < num_partitions; ++b) {
+            occupied[b] = bucket_info[b].occupied;
+        }
+        print_stats(list_bucket_sizes(num_partitions));
+        return;
+    }
+
     is_boundarys.resize(num_partitions);
     occupied.resize(num_partitions);
     for (bid_t b = 0; b < num_partitions; ++b) {
@@ -236,18 +556,136 @@ void FsmPartitioner::calculate_stats()
 }
 
 
-vid_t FsmPartitioner::merge_bucket(bid_t dst, bid_t src, bool &has_intersection)   // dst, src
+// Swaps sub-buckets between the final buckets, best gain first, while the
+// total replicas drop and -refine_time allows. No final bucket may end up
+// with more edges than the largest one of the greedy merge.
+void FsmPartitioner::refine_merge(ReplicaOverlap &overlap, std::unordered_map<bid_t, bid_t> &valid_bucket)
 {
-    auto &is_mirror_a = bucket_info[dst].is_mirror, &is_mirror_b = bucket_info[src].is_mirror;
-    size_t mirror_cnt = 0;
-    for (size_t i = 0; i < is_mirror_a.size(); ++i) {
-        if (is_mirror_a.get(i) == 1 || is_mirror_b.get(i) == 1) {
-            is_mirror_a.set_bit_unsync(i);
-            ++mirror_cnt;
+    Timer refine_timer;
+    refine_timer.start();
+    const bid_t num_buckets = num_partitions * k;
+
+    // group = final bucket, whose union is held by its chosen sub-bucket
+    std::vector<bid_t> group_of(num_buckets), head_of(num_partitions, kInvalidBid);
+    std::vector<size_t> sub_occupied(num_buckets), loads(num_partitions, 0);
+    for (bid_t b = 0; b < num_buckets; ++b) {
+        group_of[b] = valid_bucket.at(bucket_info[b].old_id);
+        sub_occupied[b] = bucket_info[b].occupied;
+        if (bucket_info[b].is_chosen) {
+            head_of[group_of[b]] = b;
+        } else {
+            loads[group_of[b]] += sub_occupied[b];
+        }
+    }
+    size_t max_load = 0;
+    for (bid_t g = 0; g < num_partitions; ++g) {
+        bid_t head = head_of[g];
+        sub_occupied[head] -= loads[g];
+        loads[g] = bucket_info[head].occupied;
+        max_load = std::max(max_load, loads[g]);
+    }
+
+    overlap.set_groups(group_of, FLAGS_threads);
+    size_t replicas_before = 0;
+    for (bid_t g = 0; g < num_partitions; ++g) {
+        replicas_before += overlap.group_size(g);
+    }
+
+    size_t num_swaps = 0;
+    while (true) {
+        refine_timer.stop();
+        if (refine_timer.get_time() >= FLAGS_refine_time) {
+            break;
+        }
+        refine_timer.start();
+
+        // (gain, a, b); ties go to the smallest pair
+        int64_t best_gain = 0;
+        bid_t best_a = kInvalidBid, best_b = kInvalidBid;
+        #pragma omp parallel num_threads(FLAGS_threads)
+        {
+            int64_t local_gain = 0;
+            bid_t local_a = kInvalidBid, local_b = kInvalidBid;
+            #pragma omp for schedule(dynamic, 1)
+            for (bid_t a = 0; a < num_buckets; ++a) {
+                bid_t g = overlap.group_of_bucket(a);
+                for (bid_t b = a + 1; b < num_buckets; ++b) {
+                    bid_t h = overlap.group_of_bucket(b);
+                    if (g == h || loads[g] - sub_occupied[a] + sub_occupied[b] > max_load ||
+                        loads[h] - sub_occupied[b] + sub_occupied[a] > max_load) {
+                        continue;
+                    }
+                    int64_t gain = overlap.swap_gain(a, b);
+                    if (gain > local_gain) {
+                        local_gain = gain;
+                        local_a = a;
+                        local_b = b;
+                    }
+                }
+            }
+            #pragma omp critical
+            if (local_gain > best_gain ||
+                (local_gain == best_gain && local_gain > 0 && std::make_pair(local_a, local_b) < std::make_pair(best_a, best_b))) {
+                best_gain = local_gain;
+                best_a = local_a;
+                best_b = local_b;
+            }
         }
-        if (!has_intersection && is_mirror_a.get(i) == 1 && is_mirror_b.get(i) == 1) {
-            has_intersection = true;
+        if (best_gain <= 0) {
+            refine_timer.stop();
+            break;
         }
+
+        bid_t g = overlap.group_of_bucket(best_a), h = overlap.group_of_bucket(best_b);
+        overlap.swap_buckets(best_a, best_b);
+        loads[g] += sub_occupied[best_b] - sub_occupied[best_a];
+        loads[h] += sub_occupied[best_a] - sub_occupied[best_b];
+        ++num_swaps;
+    }
+
+    size_t replicas_after = 0;
+    for (bid_t g = 0; g < num_partitions; ++g) {
+        replicas_after += overlap.group_size(g);
+    }
+    LOG(INFO) << "refinement: " << num_swaps << " swaps, replicas " << replicas_before
+              << " -> " << replicas_after << ", time " << refine_timer.get_time();
+    if (num_swaps == 0) {
+        return;
+    }
+
+    for (bid_t b = 0; b < num_buckets; ++b) {
+        valid_bucket[bucket_info[b].old_id] = overlap.group_of_bucket(b);
+    }
+    for (bid_t g = 0; g < num_partitions; ++g) {
+        bucket_info[head_of[g]].replicas = overlap.group_size(g);
+        bucket_info[head_of[g]].occupied = loads[g];
+    }
+    if (replica_lists) {
+        return;
+    }
+
+    // the heads hold the unions of the greedy groups, rebuild them from the
+    // buckets of every vertex
+    for (bid_t g = 0; g < num_partitions; ++g) {
+        bucket_info[head_of[g]].is_mirror.clear();
+    }
+    overlap.for_each_replica([&](vid_t v, bid_t b) {
+        bucket_info[head_of[overlap.group_of_bucket(b)]].is_mirror.set_bit_unsync(v);
+    });
+    for (bid_t g = 0; g < num_partitions; ++g) {
+        CHECK_EQ(bucket_info[head_of[g]].is_mirror.popcount(), overlap.group_size(g));
+    }
+}
+
+// with -fsm_replicas lists, the union comes from the overlaps, before src joins group
+vid_t FsmPartitioner::merge_bucket(ReplicaOverlap &overlap, bid_t group, bid_t dst, bid_t src, bool &has_intersection)   // dst, src
+{
+    size_t mirror_cnt;
+    if (replica_lists) {
+        has_intersection = overlap.group_overlap(group, src) > 0;
+        mirror_cnt = overlap.union_size(group, src);
+    } else {
+        mirror_cnt = bucket_info[dst].is_mirror.merge(bucket_info[src].is_mirror, has_intersection);
     }
     bucket_info[dst].replicas = mirror_cnt;
     bucket_info[dst].occupied += bucket_info[src].occupied;
@@ -263,8 +701,11 @@ void FsmPartitioner::split()
 
     LOG(INFO) << "partitioning...";
 
-    split_partitioner->split();
-    {
+    if (FLAGS_merge_only) {
+        partition_time.start();
+    } else {
+        split_partitioner->split();
+
         for (bid_t bucket = 0; bucket < num_partitions * k; ++bucket) {
             std::swap(split_partitioner->is_boundarys[bucket], bucket_info[bucket].is_mirror);
             std::swap(split_partitioner->occupied[bucket], bucket_info[bucket].occupied);
@@ -277,7 +718,7 @@ void FsmPartitioner::split()
         if (split_method == "hep") {
             std::swap(split_partitioner->edges, edges);
             std::swap(split_partitioner->degrees, degrees);
-            std::swap(split_partitioner->mem_graph, mem_graph);
+            std::swap(static_cast<AdjListEPartitioner<adj_with_bid_t> &>(*split_partitioner).mem_graph, mem_graph);
             std::swap(split_partitioner->edgelist2bucket, edgelist2bucket);
             // std::cerr << "edgelist2bucket.size: " << edgelist2bucket.size() << std::endl;
             
@@ -290,20 +731,18 @@ void FsmPartitioner::split()
             //     fin.read((char *)&edges[0], sizeof(edge_t) * num_edges);
             // }
         } else {
+            // empty after the streaming splits, parallel_for_each_edge streams them
             std::swap(split_partitioner->edges, edges);
             std::swap(split_partitioner->edgelist2bucket, edgelist2bucket);
-            
-            if (edges.size() == 0) {
-                LOG(INFO) << "Loading edges list...";
-                std::ifstream fin(binedgelist_name(basefilename),
-                        std::ios::binary | std::ios::ate); 
-                fin.seekg(sizeof(num_vertices) + sizeof(num_edges), std::ios::beg);
-                edges.resize(num_edges);
-                fin.read((char *)&edges[0], sizeof(edge_t) * num_edges);
-            }
         }
         
     }
+    if (FLAGS_save_split) {
+        save_split();
+    }
+    if (replica_lists) {
+        bitsets_to_lists();
+    }
 
     std::cerr << "\n" << std::string(25, '#') << " Split phase end, Merge phase start " << std::string(25, '#') << "\n\n";
 
@@ -314,32 +753,121 @@ void FsmPartitioner::split()
     merge_timer.stop();
     partition_time.stop();
 
-    CHECK_EQ(assigned_edges, num_edges);
-
     LOG(INFO) << "spliting time: " << split_timer.get_time();
     LOG(INFO) << "merging time: " << merge_timer.get_time();
     LOG(INFO) << "partitioning time: " << partition_time.get_time();
 
     calculate_stats();
+    save_partition();
+
+    // every coarser level merges the final buckets of the level before
+    std::vector<int> levels = partition_levels();
+    for (size_t level = 1; level < levels.size(); ++level) {
+        k = num_partitions / levels[level];
+        num_partitions = levels[level];
+        for (auto &info : bucket_info) {
+            info.is_chosen = false;
+        }
+        open_writer(level);
 
-    if (split_method == "hep") {
-        CHECK_EQ(check_edge_hybrid(), true);
-    } else {
-        CHECK_EQ(check_edge(), true);
-    }
+        Timer level_timer;
+        level_timer.start();
+        merge();
+        level_timer.stop();
+        LOG(INFO) << "level " << level << " (" << (uint32_t)num_partitions
+                  << " partitions) merging time: " << level_timer.get_time();
 
+        calculate_stats();
+        save_partition();
+    }
+}
 
+// One parallel pass over the edges after every merge: each edge moves to
+// its partition, is checked against the replicas (-verify) and goes to the
+// output through per-thread buffers.
+void FsmPartitioner::save_partition()
+{
+    Timer pass_timer;
+    pass_timer.start();
+    const bool verify = FLAGS_verify != "none", full = FLAGS_verify == "full";
+    if (verify) {
+        CHECK(all_vertices_assigned()) << "a vertex has no replica";
+    }
+    // -verify full: the replicas rebuilt from the edges, or the list entries that have an edge
+    std::vector<dense_bitset> dbitsets;
+    dense_bitset has_edge;
+    if (full) {
+        if (replica_lists) {
+            has_edge = dense_bitset(replica_buckets.size());
+        } else {
+            dbitsets.assign(num_partitions, dense_bitset(num_vertices));
+        }
+    }
 
     if (FLAGS_write != "none") 
         LOG(INFO) << "Writing result...";
 
-    if (split_method == "hep") {
-        save_edge_hybrid();
-    } else {
-        for (eid_t i = 0; i < edgelist2bucket.size(); ++i) {
-            writer->save_edge(edges[i].first, edges[i].second, edgelist2bucket[i]);
-        }
+    struct pass_state_t {
+        EdgepartBlockWriter<vid_t, bid_t> block_writer;
+        eid_t num_edges = 0;
+        bool found = true;
+
+        pass_state_t(EdgepartWriterBase<vid_t, bid_t> &writer) : block_writer(writer) {}
+    };
+    std::vector<std::unique_ptr<pass_state_t>> states(FLAGS_threads);
+    for (auto &state : states) {
+        state = std::make_unique<pass_state_t>(*writer);
     }
 
-    
-}
\ No newline at end of file
+    parallel_for_each_edge([&](bid_t &edge_bucket, vid_t u, vid_t v) {
+        pass_state_t &state = *states[omp_get_thread_num()];
+        bid_t bucket = final_bucket[edge_bucket];
+        CHECK(bucket != kInvalidBid) << "bucket " << (uint32_t)edge_bucket << " should not be left in the final round";
+        edge_bucket = bucket;
+        ++state.num_edges;
+        if (replica_lists && verify) {
+            for (vid_t w : {u, v}) {
+                auto begin = replica_buckets.begin() + replica_offsets[w], end = replica_buckets.begin() + replica_offsets[w + 1];
+                auto it = std::lower_bound(begin, end, bucket);
+                if (it == end || *it != bucket) {
+                    state.found = false;
+                } else if (full && !has_edge.get(it - replica_buckets.begin())) {
+                    has_edge.set_bit(it - replica_buckets.begin());
+                }
+            }
+        } else if (full) {
+            dense_bitset &dbitset = dbitsets[bucket];
+            if (!dbitset.get(u)) {
+                dbitset.set_bit(u);
+            }
+            if (!dbitset.get(v)) {
+                dbitset.set_bit(v);
+            }
+        } else if (verify) {
+            const dense_bitset &is_mirror = bucket_info[bucket].is_mirror;
+            state.found = state.found && is_mirror.get(u) && is_mirror.get(v);
+        }
+        state.block_writer.save_edge(u, v, bucket);
+    });
+
+    assigned_edges = 0;
+    bool found = true;
+    for (auto &state : states) {
+        state->block_writer.flush();
+        assigned_edges += state->num_edges;
+        found = found && state->found;
+    }
+    writer->flush();
+    CHECK_EQ(assigned_edges, num_edges);
+    if (full && replica_lists) {
+        found = found && has_edge.popcount() == replica_buckets.size();
+    } else if (full) {
+        #pragma omp parallel for num_threads(FLAGS_threads) reduction(&& : found)
+        for (bid_t b = 0; b < num_partitions; ++b) {
+            found = found && dbitsets[b] == bucket_info[b].is_mirror;
+        }
+    }
+    CHECK(found) << "the partitions do not match the edges";
+    pass_timer.stop();
+    LOG(INFO) << "final pass (" << FLAGS_verify << " verify) time: " << pass_timer.get_time();
+}
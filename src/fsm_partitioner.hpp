@@ -7,21 +7,31 @@
 
 #include "min_heap.hpp"
 #include "dense_bitset.hpp"
+#include "edge_stream.hpp"
 #include "part_writer.hpp"
 #include "partitioner.hpp"
 #include "hep_graph.hpp"
+#include "replica_overlap.hpp"
 
 /* Fine-grained SplitMerge Partitioner (FSM) */
 class FsmPartitioner : public AdjListEPartitioner<adj_with_bid_t>
 {
   
 private:
-    std::unique_ptr<AdjListEPartitioner> split_partitioner;
+    std::unique_ptr<EdgePartitioner> split_partitioner;
     std::string split_method;
+    bool hep_edges; // the edges are in HEP's adjacency lists and h2h edge list, not edges/edgelist2bucket
+
+    // -fsm_replicas lists: the buckets of every vertex, sorted, as a CSR over
+    // the vertex ids, instead of the is_mirror bitsets
+    bool replica_lists;
+    std::vector<eid_t> replica_offsets;
+    std::vector<bid_t> replica_buckets;
 
     std::string basefilename;
 
     eid_t assigned_edges;
+    std::vector<bid_t> final_bucket; // bucket of the merged level -> partition, applied to the edges by save_partition
     bid_t k;
 
     using AdjListEPartitioner<adj_with_bid_t>::total_time;
@@ -74,156 +84,118 @@ private:
         }
         LOG(INFO) << "num_adjlist_edges: " << num_adjlist_edges;
 
-        LOG(INFO) << "Streamingly iterating edges (edgelist on disk)";
         eid_t num_edgelist_edges = 0;
+        if (mem_graph.h2h_in_memory) {
+            LOG(INFO) << "In-memory iterating edges (h2h edgelist in memory)";
+            for (eid_t id_h2h_edges = 0; id_h2h_edges < mem_graph.num_h2h_edges; ++id_h2h_edges) {
+                const edge_t &e = mem_graph.h2h_edges[id_h2h_edges];
+                ++num_edgelist_edges;
+                edge_handler(edgelist2bucket[id_h2h_edges], e.first, e.second);
+            }
+            LOG(INFO) << "num_edgelist_edges: " << num_edgelist_edges;
+            return num_adjlist_edges + num_edgelist_edges;
+        }
 
-        mem_graph.h2h_file.open(h2hedgelist_name(basefilename), std::ios_base::binary | std::ios_base::in);
-        mem_graph.h2h_file.seekg(0, std::ios::beg);
-
-        std::vector<edge_t> stream_edges; // temporary buffer to read edges from file
+        LOG(INFO) << "Streamingly iterating edges (edgelist on disk)";
+        EdgeStream stream(h2hedgelist_name(basefilename), 0, mem_graph.num_h2h_edges);
+        const edge_t *stream_edges;
         eid_t chunk_size;
-        eid_t left_h2h_edges = mem_graph.num_h2h_edges;
         eid_t id_h2h_edges = 0;
 
-        if (left_h2h_edges >= 100000) {
-            chunk_size = 100000; // batch read of so many edges
-        } else {
-            chunk_size = left_h2h_edges;
-        }
-        stream_edges.resize(chunk_size);
-
-        while (left_h2h_edges > 0) { // edges to be read
-            mem_graph.h2h_file.read((char *)&stream_edges[0], sizeof(edge_t) * chunk_size);
+        while ((chunk_size = stream.next(stream_edges)) > 0) {
             for (eid_t i = 0; i < chunk_size; ++i) {
                 auto &edge_bucket = edgelist2bucket[id_h2h_edges++];
                 ++num_edgelist_edges;
                 edge_handler(edge_bucket, stream_edges[i].first, stream_edges[i].second);
             }
-
-            left_h2h_edges -= chunk_size;
-            if (left_h2h_edges < chunk_size) { // adapt chunk size for last batch read
-                chunk_size = left_h2h_edges;
-            }
         }
         LOG(INFO) << "num_edgelist_edges: " << num_edgelist_edges;
 
-        mem_graph.h2h_file.close();
         return num_adjlist_edges + num_edgelist_edges;
     }
     
-    eid_t rearrange_edge(std::vector<edge_t> &e, const std::unordered_map<bid_t, bid_t> &valid_bucket)
+    // iterate_edges over the threads: the adjacency lists by blocks of
+    // vertices, the h2h edges by index, a chunk at a time when streamed
+    template<typename EdgeHandler>
+    void parallel_iterate_edges(EdgeHandler edge_handler)
     {
-        eid_t curr_assigned_edges = 0;
-        for (eid_t edge_id = 0; edge_id < e.size(); ++edge_id) {
-            auto &edge_bucket = edgelist2bucket[edge_id];
-            e[edge_id].recover();
-            if (valid_bucket.count(edge_bucket)) {
-                edge_bucket = valid_bucket.at(edge_bucket);
-                // e[edge_id].remove();
-                ++curr_assigned_edges;
-            } else {        // [[unlikely]]  No edge should be left
-                LOG(FATAL) << "Edge(id): " << edge_id << ", bucket: " << edge_bucket << ", should not be left in the final round\n";
-            }
+        const vid_t block_vertices = 4096;
+        const vid_t num_blocks = (num_vertices + block_vertices - 1) / block_vertices;
+        std::vector<eid_t> block_offsets(num_blocks + 1, 0);
+        for (vid_t from = 0; from < num_vertices; ++from) {
+            if (degrees[from] > mem_graph.high_degree_threshold) continue;
+            block_offsets[from / block_vertices + 1] += degrees[from];
         }
-        return curr_assigned_edges;
-    }
-
-    eid_t rearrange_edge_hybrid(const std::unordered_map<bid_t, bid_t> &valid_bucket)
-    {
-        return iterate_edges( 
-            [this, &valid_bucket](bid_t& edge_bucket, 
-                const vid_t& u, const vid_t& v) {
-                if (valid_bucket.count(edge_bucket)) {
-                    edge_bucket = valid_bucket.at(edge_bucket);
-                } else {
-                    LOG(FATAL) << "bucket: " << edge_bucket 
-                            << ", should not be left in the final round\n";
+        for (vid_t block = 0; block < num_blocks; ++block) {
+            block_offsets[block + 1] += block_offsets[block];
+        }
+        #pragma omp parallel for num_threads(FLAGS_threads) schedule(dynamic, 1)
+        for (vid_t block = 0; block < num_blocks; ++block) {
+            eid_t offset = block_offsets[block];
+            const vid_t end = std::min(num_vertices, (block + 1) * block_vertices);
+            for (vid_t from = block * block_vertices; from < end; ++from) {
+                if (degrees[from] > mem_graph.high_degree_threshold) continue;
+                for (vid_t i = 0; i < degrees[from]; ++i) {
+                    auto& to = mem_graph.neighbors[offset + i];
+                    auto& edge_bucket = reinterpret_cast<bid_t&>(to.bid);
+                    if (edge_bucket != kInvalidBid) {
+                        edge_handler(edge_bucket, from, to.vid);
+                    }
                 }
+                offset += degrees[from];
             }
-        );
-    }
+        }
 
-    bool check_edge_hybrid()
-    {
-        std::vector<dense_bitset> dbitsets(num_partitions, dense_bitset(num_vertices));
-        for (vid_t vid = 0; vid < num_vertices; ++vid) {
-            bool assigned_to_a_part = false;
-            for (bid_t b = 0; b < num_partitions; ++b) {
-                if (bucket_info[b].is_mirror.get(vid)) {
-                    assigned_to_a_part = true;
-                    break;
-                }
-            }
-            if (!assigned_to_a_part) {
-                return false;
+        if (mem_graph.h2h_in_memory) {
+            #pragma omp parallel for num_threads(FLAGS_threads)
+            for (eid_t id_h2h_edges = 0; id_h2h_edges < mem_graph.num_h2h_edges; ++id_h2h_edges) {
+                const edge_t &e = mem_graph.h2h_edges[id_h2h_edges];
+                edge_handler(edgelist2bucket[id_h2h_edges], e.first, e.second);
             }
+            return;
         }
-        iterate_edges(
-            [&dbitsets](bid_t& edge_bucket, const vid_t& u, const vid_t& v) {
-                dbitsets[edge_bucket].set_bit_unsync(u);
-                dbitsets[edge_bucket].set_bit_unsync(v);
+        EdgeStream stream(h2hedgelist_name(basefilename), 0, mem_graph.num_h2h_edges);
+        const edge_t *stream_edges;
+        eid_t chunk_size;
+        eid_t id_h2h_edges = 0;
+        while ((chunk_size = stream.next(stream_edges)) > 0) {
+            #pragma omp parallel for num_threads(FLAGS_threads)
+            for (eid_t i = 0; i < chunk_size; ++i) {
+                edge_handler(edgelist2bucket[id_h2h_edges + i], stream_edges[i].first, stream_edges[i].second);
             }
-        );
-        // for (size_t edge_id = 0; edge_id < num_edges; ++edge_id) {
-        //     // edges[edge_id].recover();
-        //     bid_t edge_bucket = edgelist2bucket[edge_id];
-        //     vid_t u = edges[edge_id].first, v = edges[edge_id].second;
-        //     dbitsets[edge_bucket].set_bit_unsync(u);
-        //     dbitsets[edge_bucket].set_bit_unsync(v);
-        // }
-        auto equal_dbitset = [&](const dense_bitset &l, const dense_bitset &r) {
-            if (l.size() != r.size()) return false;
-            for (size_t bit = 0; bit < l.size(); ++bit) {
-                if (l.get(bit) != r.get(bit)) { return false; }
-            }   
-            return true;
-        };
-        for (bid_t b = 0; b < num_partitions; ++b) {
-            if (!equal_dbitset(dbitsets[b], bucket_info[b].is_mirror)) { return false; }
+            id_h2h_edges += chunk_size;
         }
-        return true;
-    }
-
-    void save_edge_hybrid()
-    {
-        iterate_edges([this](bid_t& edge_bucket, const vid_t& u, const vid_t& v) {
-            writer->save_edge(u, v, edge_bucket);
-        });
     }
 
-    bool check_edge()
+    // every assigned edge with its bucket, over the threads. The streaming
+    // splits (hdrf, dbh) keep no edges, which are streamed from the
+    // binedgelist a chunk at a time.
+    template<typename EdgeHandler>
+    void parallel_for_each_edge(EdgeHandler edge_handler)
     {
-        std::vector<dense_bitset> dbitsets(num_partitions, dense_bitset(num_vertices));
-        for (vid_t vid = 0; vid < num_vertices; ++vid) {
-            bool assigned_to_a_part = false;
-            for (bid_t b = 0; b < num_partitions; ++b) {
-                if (bucket_info[b].is_mirror.get(vid)) {
-                    assigned_to_a_part = true;
-                    break;
+        if (hep_edges) {
+            parallel_iterate_edges(edge_handler);
+            return;
+        }
+        if (edges.empty()) {
+            EdgeStream stream(binedgelist_name(basefilename), sizeof(num_vertices) + sizeof(num_edges), num_edges);
+            const edge_t *stream_edges;
+            eid_t chunk_size;
+            eid_t edge_id = 0;
+            while ((chunk_size = stream.next(stream_edges)) > 0) {
+                #pragma omp parallel for num_threads(FLAGS_threads)
+                for (eid_t i = 0; i < chunk_size; ++i) {
+                    edge_handler(edgelist2bucket[edge_id + i], stream_edges[i].first, stream_edges[i].second);
                 }
+                edge_id += chunk_size;
             }
-            if (!assigned_to_a_part) {
-                return false;
-            }
+            return;
         }
+        #pragma omp parallel for num_threads(FLAGS_threads)
         for (eid_t edge_id = 0; edge_id < num_edges; ++edge_id) {
-            // edges[edge_id].recover();
-            bid_t edge_bucket = edgelist2bucket[edge_id];
-            vid_t u = edges[edge_id].first, v = edges[edge_id].second;
-            dbitsets[edge_bucket].set_bit_unsync(u);
-            dbitsets[edge_bucket].set_bit_unsync(v);
-        }
-        auto equal_dbitset = [&](const dense_bitset &l, const dense_bitset &r) {
-            if (l.size() != r.size()) return false;
-            for (size_t bit = 0; bit < l.size(); ++bit) {
-                if (l.get(bit) != r.get(bit)) { return false; }
-            }   
-            return true;
-        };
-        for (bid_t b = 0; b < num_partitions; ++b) {
-            if (!equal_dbitset(dbitsets[b], bucket_info[b].is_mirror)) { return false; }
+            edges[edge_id].recover(); // NE marks the edges it assigned as removed
+            edge_handler(edgelist2bucket[edge_id], edges[edge_id].first, edges[edge_id].second);
         }
-        return true;
     }
 
     std::unordered_map<bid_t, bid_t> mp;
@@ -237,12 +209,21 @@ private:
         }
     }
 
+    void open_writer(int level);
+    void bitsets_to_lists();
+    void relabel_lists(const std::vector<bid_t> &new_id);
+    std::vector<vid_t> list_bucket_sizes(size_t num_buckets) const;
+    bool all_vertices_assigned();
+    void save_split();
+    void load_split();
     void merge();
     void calculate_stats();
+    void save_partition();
 
-    vid_t merge_bucket(bid_t dst, bid_t src, bool &has_intersection);
-    std::unordered_map<bid_t, bid_t> fast_merge();
-    std::unordered_map<bid_t, bid_t> precise_merge();
+    vid_t merge_bucket(ReplicaOverlap &overlap, bid_t group, bid_t dst, bid_t src, bool &has_intersection);
+    std::unordered_map<bid_t, bid_t> fast_merge(ReplicaOverlap &overlap);
+    std::unordered_map<bid_t, bid_t> precise_merge(ReplicaOverlap &overlap);
+    void refine_merge(ReplicaOverlap &overlap, std::unordered_map<bid_t, bid_t> &valid_bucket);
 
 public:
     FsmPartitioner(std::string basefilename);
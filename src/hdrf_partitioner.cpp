@@ -1,8 +1,11 @@
+#include <omp.h>
+#include <mutex>
+
 #include "hdrf_partitioner.hpp"
 #include "conversions.hpp"
 
 HdrfPartitioner::HdrfPartitioner(std::string basefilename, bool need_k_split)
-    : basefilename(basefilename)
+    : basefilename(basefilename), need_k_split(need_k_split)
 {
     if (need_k_split || FLAGS_write == "none") {
         writer = std::make_unique<EdgepartWriterBase<vid_t, bid_t>>(basefilename);
@@ -44,10 +47,14 @@ HdrfPartitioner::HdrfPartitioner(std::string basefilename, bool need_k_split)
 
     LOG(INFO) << "constructing...";
 
-    is_boundarys.assign(num_partitions, dense_bitset(num_vertices));
+    replicas.init(num_vertices, num_partitions);
+    hdrf_kernel = select_hdrf_kernel();
     occupied.assign(num_partitions, 0);
+    loads.assign(num_partitions);
     capacity = (double)num_edges * 1.0 / num_partitions + 1; //will be used to as stopping criterion later
-    // edgelist2bucket.assign(num_edges, kInvalidBid);
+    if (need_k_split) {
+        edgelist2bucket.assign(num_edges, kInvalidBid);
+    }
 
     degrees.resize(num_vertices);
     std::ifstream degree_file(degree_name(basefilename), std::ios::binary);
@@ -59,6 +66,11 @@ HdrfPartitioner::HdrfPartitioner(std::string basefilename, bool need_k_split)
 void HdrfPartitioner::split()
 {
     partition_time.start();
+    if (FLAGS_threads > 1) {
+        CHECK_EQ(FLAGS_passes, 1) << "-passes is not supported by the parallel HDRF";
+        parallel_split();
+        return;
+    }
     // std::shuffle(edges.begin(), edges.end(), rd);
     // for (eid_t eid = 0; eid < num_edges; ++eid) {
     //     edge_t e = edges[eid];
@@ -84,91 +96,120 @@ void HdrfPartitioner::split()
     //     }
     // }
 
-    std::vector<edge_t> stream_edges; // temporary buffer to read edges from file
-    eid_t chunk_size = std::min(num_edges, (eid_t)100000);
-    eid_t num_remaining_edges = num_edges; // number of edges to be read from file
+    if (FLAGS_passes > 1) {
+        edgelist2bucket.assign(num_edges, kInvalidBid);
+        replica_counts.init(num_vertices, num_partitions);
+    }
+    for (pass = 1; pass <= FLAGS_passes; ++pass) {
+        Timer pass_timer;
+        pass_timer.start();
+        EdgeStream stream(binedgelist_name(basefilename), sizeof(num_vertices) + sizeof(num_edges), num_edges);
+        const edge_t *stream_edges;
+        eid_t chunk_size;
+
+        eid_t eid = 0; // number of edges read from file
+        while ((chunk_size = stream.next(stream_edges)) > 0) {
+            for (eid_t i = 0; i < chunk_size; ++i, ++eid) {
+                const auto& [u, v] = stream_edges[i];
+                if (eid % 50000000 == 0) {
+                    LOG(INFO) << "Processing edges " << eid;
+                }
+                if (pass > 1) {
+                    unassign_edge(edgelist2bucket[eid], u, v);
+                }
+                bid_t bucket = best_scored_partition(u, v); // according to ebv scoring
+                assign_edge(bucket, u, v, eid);
+            }
+        }
 
-    std::ifstream fin(binedgelist_name(basefilename),
-                      std::ios::binary | std::ios::ate);
-    fin.seekg(sizeof(num_vertices) + sizeof(num_edges), std::ios::beg); 
+        pass_timer.stop();
+        if (FLAGS_passes > 1) {
+            std::vector<vid_t> sizes = replicas.partition_sizes(num_partitions);
+            LOG(INFO) << "pass " << pass << ": replication factor "
+                      << (double)std::accumulate(sizes.begin(), sizes.end(), (eid_t)0) / num_vertices
+                      << ", time " << pass_timer.get_time();
+        }
+    }
 
-    stream_edges.resize(chunk_size);
+    partition_time.stop();
+    total_time.stop();
+    LOG(INFO) << "partition time: " << partition_time.get_time();
+    LOG(INFO) << "total partition time: " << total_time.get_time();
+    calculate_stats();
+}
 
-    eid_t eid = 0; // number of edges read from file
-    while (num_remaining_edges > 0) { // edges to be read
-        fin.read((char *)&stream_edges[0], sizeof(edge_t) * chunk_size);
-        for (eid_t i = 0; i < chunk_size; ++i, ++eid) {
-            const auto& [u, v] = stream_edges[i];
-            if (eid % 50000000 == 0) {
-                LOG(INFO) << "Processing edges " << eid;
-            }
-            bid_t bucket = best_scored_partition(u, v); // according to ebv scoring
-            assign_edge(bucket, u, v, eid);
-            if (occupied[bucket] > max_size) {
-                max_size = occupied[bucket];
-            }
-            if (occupied[bucket] == min_size) {
-                int min_sized_bucket_count = 0;
-                for (bid_t b = 0; b < num_partitions; ++b) {
-                    if (occupied[b] == min_size) {
-                        ++min_sized_bucket_count;
+// Each thread streams its own slice of the edge file and scores against a
+// private copy of occupied, refreshed from the shared counters every
+// kRefreshInterval edges. Replicas and counters are shared and updated
+// atomically, so threads see each other's placements with some delay.
+void HdrfPartitioner::parallel_split()
+{
+    const int num_threads = FLAGS_threads;
+    const eid_t kRefreshInterval = 1024;
+    LOG(INFO) << "parallel HDRF with " << num_threads << " threads";
+    const bool write_out = FLAGS_write != "none";
+    std::mutex writer_mutex;
+
+    #pragma omp parallel num_threads(num_threads)
+    {
+        int t = omp_get_thread_num();
+        eid_t begin = num_edges * t / num_threads, end = num_edges * (t + 1) / num_threads;
+        EdgeStream stream(binedgelist_name(basefilename),
+                          sizeof(num_vertices) + sizeof(num_edges) + begin * sizeof(edge_t), end - begin);
+        const edge_t *stream_edges;
+        eid_t chunk_size;
+
+        std::vector<eid_t> snapshot(num_partitions);
+        LoadTracker local_loads;
+        std::vector<std::tuple<vid_t, vid_t, bid_t>> assigned; // written out once per chunk
+
+        eid_t num_local_edges = 0;
+        while ((chunk_size = stream.next(stream_edges)) > 0) {
+            for (eid_t i = 0; i < chunk_size; ++i, ++num_local_edges) {
+                if (num_local_edges % kRefreshInterval == 0) {
+                    for (bid_t b = 0; b < num_partitions; ++b) {
+                        snapshot[b] = __atomic_load_n(&occupied[b], __ATOMIC_RELAXED);
                     }
+                    local_loads.assign(snapshot);
+                }
+                const auto& [u, v] = stream_edges[i];
+                hdrf_edge_t e(replicas, u, v, degrees[u], degrees[v], lambda,
+                              local_loads.max(), local_loads.min(), capacity);
+                bid_t bucket = hdrf_kernel(e, local_loads.data(), num_partitions);
+                if (bucket == kInvalidBid) {
+                    bucket = 0;
                 }
-                if (min_sized_bucket_count == 1) {
-                    ++min_size;
+
+                __sync_fetch_and_add(&occupied[bucket], 1);
+                local_loads.increment(bucket);
+                replicas.set_sync(u, bucket);
+                replicas.set_sync(v, bucket);
+                if (!edgelist2bucket.empty()) {
+                    edgelist2bucket[begin + num_local_edges] = bucket;
+                }
+                if (write_out) {
+                    assigned.emplace_back(u, v, bucket);
                 }
             }
-        }
 
-        num_remaining_edges -= chunk_size;
-        if (num_remaining_edges < chunk_size) { // adapt chunk size for last batch read
-            chunk_size = num_remaining_edges;
+            std::lock_guard<std::mutex> lock(writer_mutex);
+            for (const auto &[u, v, bucket] : assigned) {
+                writer->save_edge(u, v, bucket);
+            }
+            assigned.clear();
         }
     }
 
     partition_time.stop();
     total_time.stop();
-    LOG(INFO) << "partition time: " << total_time.get_time();
+    LOG(INFO) << "partition time: " << partition_time.get_time();
     LOG(INFO) << "total partition time: " << total_time.get_time();
     calculate_stats();
 }
 
 bid_t HdrfPartitioner::best_scored_partition(vid_t u, vid_t v) 
 {
-	double best_score = -1.0;
-	bid_t best_partition = 0;
-	for (bid_t b = 0; b < num_partitions; ++b) {
-		double score = compute_partition_score(u, v, b);
-		if (score > best_score) {
-			best_score = score;
-			best_partition = b;
-		}
-	}
-	return best_partition;
-}
-
-double HdrfPartitioner::compute_partition_score(vid_t u, vid_t v, bid_t bucket_id) 
-{
-	if (occupied[bucket_id] >= capacity) {
-		return -1.0; // partition is full, do not choose it
-	}
-	vid_t degree_u = degrees[u];
-	vid_t degree_v = degrees[v];
-	vid_t sum = degree_u + degree_v;
-	double gu = 0.0, gv = 0.0;
-	if (is_boundarys[bucket_id].get(u)) {
-		gu = degree_u;
-		gu /= sum;
-		gu = 1 + (1 - gu);
-	}
-	if (is_boundarys[bucket_id].get(v)) {
-        gv = degree_v;
-        gv /= sum;
-        gv = 1 + (1 - gv);
-	}
-
-	double bal = (max_size - occupied[bucket_id]) / (1.0 + max_size - min_size);
-
-	double score = gu + gv + lambda * bal;
-	return score;
+	hdrf_edge_t e(replicas, u, v, degrees[u], degrees[v], lambda, loads.max(), loads.min(), capacity);
+	bid_t best_partition = hdrf_kernel(e, loads.data(), num_partitions);
+	return best_partition == kInvalidBid ? 0 : best_partition;
 }
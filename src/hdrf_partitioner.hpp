@@ -5,6 +5,10 @@
 // #include <numeric>
 
 #include "dense_bitset.hpp"
+#include "edge_stream.hpp"
+#include "hdrf_score.hpp"
+#include "load_tracker.hpp"
+#include "replica_counts.hpp"
 #include "part_writer.hpp"
 #include "ne_graph.hpp"
 #include "partitioner.hpp"
@@ -17,22 +21,62 @@ class HdrfPartitioner : public EdgeListEPartitioner
     std::unique_ptr<EdgepartWriterBase<vid_t, bid_t>> writer = nullptr;
     vid_t max_degree;
     eid_t capacity;
-    eid_t min_size = 0; // currently smallest partition
-    eid_t max_size = 0; // currently largest partition
+    LoadTracker loads; // occupied with its current min and max
     double lambda = 1.10;
 
+    // the only replica store of the split; is_boundarys is filled from it at
+    // the end for FSM
+    replica_masks_t replicas;
+    hdrf_kernel_t hdrf_kernel;
+    bool need_k_split;
+
+    // -passes > 1: replica_counts decides when a replica leaves the masks
+    int pass = 1;
+    replica_counts_t replica_counts;
+
     void assign_edge(bid_t bucket, vid_t from, vid_t to, eid_t edge_id)
     {
-        writer->save_edge(from, to, bucket);
-        // edgelist2bucket[edge_id] = bucket;
+        if (pass == FLAGS_passes) {
+            writer->save_edge(from, to, bucket);
+        }
+        if (!edgelist2bucket.empty()) {
+            edgelist2bucket[edge_id] = bucket;
+        }
         ++occupied[bucket];
+        loads.increment(bucket);
 
-        is_boundarys[bucket].set_bit_unsync(from);
-        is_boundarys[bucket].set_bit_unsync(to);
+        replicas.set(from, bucket);
+        replicas.set(to, bucket);
+        if (!replica_counts.empty()) {
+            replica_counts.add(from, bucket);
+            replica_counts.add(to, bucket);
+        }
+    }
+
+    /// takes the placement of the previous pass out before the edge is re-scored
+    void unassign_edge(bid_t bucket, vid_t from, vid_t to)
+    {
+        --occupied[bucket];
+        loads.decrement(bucket);
+        if (replica_counts.remove(from, bucket)) {
+            replicas.clear(from, bucket);
+        }
+        if (replica_counts.remove(to, bucket)) {
+            replicas.clear(to, bucket);
+        }
     }
 
     bid_t best_scored_partition(vid_t u, vid_t v); // returns bucket id where score is best for edge (u,v)
-    double compute_partition_score(vid_t u, vid_t v, bid_t bucket_id);
+
+    void parallel_split(); // -threads > 1
+
+    void calculate_stats(bool called_by_fsm = false)
+    {
+        print_stats(replicas.partition_sizes(num_partitions));
+        if (need_k_split) {
+            is_boundarys = replicas.release_bitsets(num_partitions);
+        }
+    }
 
   public:
     HdrfPartitioner(std::string basefilename, bool need_k_split);
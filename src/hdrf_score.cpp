@@ -0,0 +1,172 @@
+#include <algorithm>
+#include <vector>
+
+#include "hdrf_score.hpp"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+DECLARE_string(hdrf_simd);
+
+// scores of all partitions are stored first, the first maximum is picked afterwards
+static bid_t first_best(const double *scores, double best_score)
+{
+    if (best_score <= -1.0) {
+        return kInvalidBid;
+    }
+    bid_t b = 0;
+    while (scores[b] != best_score) {
+        ++b;
+    }
+    return b;
+}
+
+static bid_t best_partition_scalar(const hdrf_edge_t &e, const eid_t *occupied, bid_t num_partitions)
+{
+    double best_score = -1.0;
+    bid_t best_partition = kInvalidBid;
+    for (bid_t b = 0; b < num_partitions; ++b) {
+        double score = hdrf_score(e, occupied, b);
+        if (score > best_score) {
+            best_score = score;
+            best_partition = b;
+        }
+    }
+    return best_partition;
+}
+
+#if defined(__x86_64__)
+
+// per-thread scores, sized to -p rather than kMaxBuckets, which would take
+// 512 KB of stack per call with 16-bit bucket ids
+static double *score_buffer(bid_t num_partitions)
+{
+    thread_local std::vector<double> scores;
+    if (scores.size() < num_partitions) {
+        scores.resize(num_partitions);
+    }
+    return scores.data();
+}
+
+// 4 partitions per step. AVX2 has no unsigned 64-bit conversion, so
+// max_size - occupied is split into 32-bit halves, each converted exactly
+// with the 2^52 / 2^84 magic numbers, and added back with a single rounding.
+__attribute__((target("avx2")))
+static bid_t best_partition_avx2(const hdrf_edge_t &e, const eid_t *occupied, bid_t num_partitions)
+{
+    double *scores = score_buffer(num_partitions);
+    const __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+    const __m256i capacity = _mm256_xor_si256(_mm256_set1_epi64x(e.capacity), sign);
+    const __m256i max_size = _mm256_set1_epi64x(e.max_size);
+    const __m256i lane_bits = _mm256_setr_epi64x(1, 2, 4, 8);
+    const __m256i lo_magic = _mm256_set1_epi64x(0x4330000000000000); // 2^52
+    const __m256i hi_magic = _mm256_set1_epi64x(0x4530000000000000); // 2^84
+    const __m256d hi_lo_magic = _mm256_set1_pd(19342813118337666422669312.); // 2^84 + 2^52
+    const __m256d gu = _mm256_set1_pd(e.gu), gv = _mm256_set1_pd(e.gv);
+    const __m256d scale = _mm256_set1_pd(e.scale), full = _mm256_set1_pd(-1.0);
+
+    __m256d best = full;
+    bid_t b = 0;
+    for (; b + 4 <= num_partitions; b += 4) {
+        __m256i occ = _mm256_loadu_si256((const __m256i *)(occupied + b));
+        __m256d not_full = _mm256_castsi256_pd(
+            _mm256_cmpgt_epi64(capacity, _mm256_xor_si256(occ, sign)));
+
+        __m256i diff = _mm256_sub_epi64(max_size, occ);
+        __m256d lo = _mm256_castsi256_pd(_mm256_blend_epi32(lo_magic, diff, 0x55));
+        __m256d hi = _mm256_castsi256_pd(_mm256_xor_si256(_mm256_srli_epi64(diff, 32), hi_magic));
+        hi = _mm256_sub_pd(hi, hi_lo_magic);
+        asm("" : "+x"(hi));
+        __m256d bal = _mm256_mul_pd(_mm256_add_pd(hi, lo), scale);
+        asm("" : "+x"(bal));
+
+        __m256i bits_u = _mm256_set1_epi64x(e.mask_u[b / 8] >> (b % 8));
+        __m256i bits_v = _mm256_set1_epi64x(e.mask_v[b / 8] >> (b % 8));
+        __m256d has_u = _mm256_castsi256_pd(
+            _mm256_cmpeq_epi64(_mm256_and_si256(bits_u, lane_bits), lane_bits));
+        __m256d has_v = _mm256_castsi256_pd(
+            _mm256_cmpeq_epi64(_mm256_and_si256(bits_v, lane_bits), lane_bits));
+        __m256d g = _mm256_add_pd(_mm256_and_pd(has_u, gu), _mm256_and_pd(has_v, gv));
+
+        __m256d score = _mm256_blendv_pd(full, _mm256_add_pd(g, bal), not_full);
+        _mm256_storeu_pd(scores + b, score);
+        best = _mm256_max_pd(best, score);
+    }
+
+    alignas(32) double lanes[4];
+    _mm256_store_pd(lanes, best);
+    double best_score = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+    for (; b < num_partitions; ++b) {
+        scores[b] = hdrf_score(e, occupied, b);
+        best_score = std::max(best_score, scores[b]);
+    }
+    return first_best(scores, best_score);
+}
+
+// 8 partitions per step, with native unsigned conversion and compares
+__attribute__((target("avx512f,avx512dq")))
+static bid_t best_partition_avx512(const hdrf_edge_t &e, const eid_t *occupied, bid_t num_partitions)
+{
+    double *scores = score_buffer(num_partitions);
+    const __m512i capacity = _mm512_set1_epi64(e.capacity);
+    const __m512i max_size = _mm512_set1_epi64(e.max_size);
+    const __m512d gu = _mm512_set1_pd(e.gu), gv = _mm512_set1_pd(e.gv);
+    const __m512d scale = _mm512_set1_pd(e.scale), full = _mm512_set1_pd(-1.0);
+
+    __m512d best = full;
+    bid_t b = 0;
+    for (; b + 8 <= num_partitions; b += 8) {
+        __m512i occ = _mm512_loadu_si512((const void *)(occupied + b));
+        __mmask8 not_full = _mm512_cmplt_epu64_mask(occ, capacity);
+
+        __m512d bal = _mm512_mul_pd(_mm512_cvtepu64_pd(_mm512_sub_epi64(max_size, occ)), scale);
+        asm("" : "+v"(bal));
+
+        __mmask8 has_u = e.mask_u[b / 8];
+        __mmask8 has_v = e.mask_v[b / 8];
+        __m512d g = _mm512_add_pd(_mm512_maskz_mov_pd(has_u, gu), _mm512_maskz_mov_pd(has_v, gv));
+
+        __m512d score = _mm512_mask_blend_pd(not_full, full, _mm512_add_pd(g, bal));
+        _mm512_storeu_pd(scores + b, score);
+        // the masked form, as _mm512_max_pd passes an undefined vector that GCC warns about
+        best = _mm512_mask_max_pd(best, 0xff, best, score);
+    }
+
+    alignas(64) double lanes[8];
+    _mm512_store_pd(lanes, best);
+    double best_score = *std::max_element(lanes, lanes + 8);
+    for (; b < num_partitions; ++b) {
+        scores[b] = hdrf_score(e, occupied, b);
+        best_score = std::max(best_score, scores[b]);
+    }
+    return first_best(scores, best_score);
+}
+
+#endif
+
+hdrf_kernel_t select_hdrf_kernel()
+{
+    std::string isa = FLAGS_hdrf_simd;
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    bool has_avx512 = __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq");
+    bool has_avx2 = __builtin_cpu_supports("avx2");
+    if (isa == "auto") {
+        isa = has_avx512 ? "avx512" : has_avx2 ? "avx2" : "none";
+    }
+    if (isa == "avx512") {
+        CHECK(has_avx512) << "-hdrf_simd avx512 is not supported by this CPU";
+        LOG(INFO) << "HDRF scoring kernel: avx512";
+        return best_partition_avx512;
+    }
+    if (isa == "avx2") {
+        CHECK(has_avx2) << "-hdrf_simd avx2 is not supported by this CPU";
+        LOG(INFO) << "HDRF scoring kernel: avx2";
+        return best_partition_avx2;
+    }
+#endif
+    CHECK(isa == "none" || isa == "auto") << "unknown -hdrf_simd: " << isa;
+    LOG(INFO) << "HDRF scoring kernel: scalar";
+    return best_partition_scalar;
+}
@@ -0,0 +1,130 @@
+#ifndef HDRF_SCORE_HPP
+#define HDRF_SCORE_HPP
+
+#include "common.hpp"
+#include "dense_bitset.hpp"
+
+/* Replica sets laid out vertex-major: the partition bits of a vertex are
+ * adjacent bytes, so a scorer reads the replicas of 8 partitions with one
+ * load. At (p + 7) / 8 bytes per vertex this takes the place of the
+ * partition-major is_boundarys while a partitioner scores with it. */
+class replica_masks_t
+{
+  private:
+    size_t bytes_per_vertex = 0;
+    std::vector<uint8_t> bits;
+
+  public:
+    void init(vid_t num_vertices, bid_t num_partitions)
+    {
+        bytes_per_vertex = (num_partitions + 7) / 8;
+        bits.assign(num_vertices * bytes_per_vertex, 0);
+    }
+
+    /// Transposes partition-major bitsets into this layout, freeing each of them once read
+    void build(std::vector<dense_bitset> &is_boundarys)
+    {
+        init(is_boundarys.empty() ? 0 : is_boundarys[0].size(), is_boundarys.size());
+        for (bid_t b = 0; b < is_boundarys.size(); ++b) {
+            for (size_t v : is_boundarys[b]) {
+                set(v, b);
+            }
+            is_boundarys[b] = dense_bitset();
+        }
+    }
+
+    /// Transposes back into partition-major bitsets and frees the masks
+    std::vector<dense_bitset> release_bitsets(bid_t num_partitions)
+    {
+        const vid_t num_vertices = bytes_per_vertex ? bits.size() / bytes_per_vertex : 0;
+        std::vector<dense_bitset> is_boundarys(num_partitions, dense_bitset(num_vertices));
+        for_each_replica([&](vid_t v, bid_t b) { is_boundarys[b].set_bit_unsync(v); });
+        std::vector<uint8_t>().swap(bits);
+        return is_boundarys;
+    }
+
+    /// number of vertices of each partition
+    std::vector<vid_t> partition_sizes(bid_t num_partitions) const
+    {
+        std::vector<vid_t> sizes(num_partitions, 0);
+        for_each_replica([&](vid_t v, bid_t b) { ++sizes[b]; });
+        return sizes;
+    }
+
+    template <typename Handler>
+    void for_each_replica(Handler handler) const
+    {
+        for (size_t i = 0; i < bits.size(); ++i) {
+            for (uint32_t byte = bits[i]; byte; byte &= byte - 1) {
+                handler(i / bytes_per_vertex, (i % bytes_per_vertex) * 8 + __builtin_ctz(byte));
+            }
+        }
+    }
+
+    bool empty() const { return bits.empty(); }
+
+    void set(vid_t v, bid_t b) { bits[v * bytes_per_vertex + b / 8] |= 1 << (b % 8); }
+
+    /// set() for concurrent writers; skips the atomic when the bit is already there
+    void set_sync(vid_t v, bid_t b)
+    {
+        uint8_t &byte = bits[v * bytes_per_vertex + b / 8];
+        const uint8_t mask = 1 << (b % 8);
+        if (!(__atomic_load_n(&byte, __ATOMIC_RELAXED) & mask)) {
+            __sync_fetch_and_or(&byte, mask);
+        }
+    }
+
+    void clear(vid_t v, bid_t b) { bits[v * bytes_per_vertex + b / 8] &= ~(1 << (b % 8)); }
+
+    bool get(vid_t v, bid_t b) const { return bits[v * bytes_per_vertex + b / 8] >> (b % 8) & 1; }
+
+    const uint8_t *of(vid_t v) const { return &bits[v * bytes_per_vertex]; }
+};
+
+/* The per-edge part of the HDRF score, shared by every partition */
+struct hdrf_edge_t {
+    const uint8_t *mask_u, *mask_v; // replicas of u and v
+    double gu, gv;                   // replication gain if u (resp. v) already is in the partition
+    double scale;                    // lambda / (1 + max_size - min_size)
+    eid_t max_size, capacity;
+
+    hdrf_edge_t(const replica_masks_t &replicas, vid_t u, vid_t v, vid_t degree_u, vid_t degree_v,
+                double lambda, eid_t max_size, eid_t min_size, eid_t capacity)
+        : mask_u(replicas.of(u)), mask_v(replicas.of(v)),
+          scale(lambda / (1.0 + max_size - min_size)), max_size(max_size), capacity(capacity)
+    {
+        vid_t sum = degree_u + degree_v;
+        gu = degree_u;
+        gu /= sum;
+        gu = 1 + (1 - gu);
+        gv = degree_v;
+        gv /= sum;
+        gv = 1 + (1 - gv);
+    }
+};
+
+/// HDRF score of partition b, -1 if it is full. max_size - occupied[b] is
+/// unsigned and wraps when the partition already is the largest one.
+inline double hdrf_score(const hdrf_edge_t &e, const eid_t *occupied, bid_t b)
+{
+    if (occupied[b] >= e.capacity) {
+        return -1.0; // partition is full, do not choose it
+    }
+    double g = ((e.mask_u[b / 8] >> (b % 8) & 1) ? e.gu : 0.0)
+               + ((e.mask_v[b / 8] >> (b % 8) & 1) ? e.gv : 0.0);
+    double bal = (double)(e.max_size - occupied[b]) * e.scale;
+#if defined(__x86_64__)
+    // keep the product rounded on its own (no FMA contraction), as the vector kernels do
+    asm("" : "+x"(bal));
+#endif
+    return g + bal;
+}
+
+/// Returns the first partition with the highest score, kInvalidBid if all are full
+using hdrf_kernel_t = bid_t (*)(const hdrf_edge_t &e, const eid_t *occupied, bid_t num_partitions);
+
+/// Picks the widest kernel the CPU supports, or the one requested by -hdrf_simd
+hdrf_kernel_t select_hdrf_kernel();
+
+#endif
@@ -134,9 +134,7 @@ eid_t mem_graph_t<adj_with_bid_t>::stream_build(std::ifstream &fin, eid_t num_ed
 	   			++savings;
                 // u AND v are both high degree vertices, treat the edge specially
 	   		  	if (degrees[u] > high_degree_threshold) {
-	   		  		edge_t edge = edge_t(u, v);
-	   		  		h2h_file.write((char*)&edge, sizeof(edge_t));
-	   		  		++num_h2h_edges;
+	   		  		save_h2h_edge(edge_t(u, v));
 	   			}
 	   		}
 	   		if (write_low_degree_edgelist && low_degree) {
@@ -151,7 +149,8 @@ eid_t mem_graph_t<adj_with_bid_t>::stream_build(std::ifstream &fin, eid_t num_ed
 	}
 
 	LOG(INFO) << "Edges to a high-degree vertex: " << savings << std::endl;
-	LOG(INFO) << "Edges between two high-degree vertices: " << num_h2h_edges << std::endl;
+	LOG(INFO) << "Edges between two high-degree vertices: " << num_h2h_edges
+	          << (h2h_in_memory ? " (kept in memory)" : " (on disk)") << std::endl;
 
 	// write the number of vertices and number of low-degree edges to the low-file
 	eid_t num_low_edges = num_all_edges - num_h2h_edges;
@@ -289,9 +288,7 @@ eid_t mem_graph_t<adj_t>::stream_build(std::ifstream &fin, eid_t num_edges, dens
 	   			++savings;
                 // u AND v are both high degree vertices, treat the edge specially
 	   		  	if (degrees[u] > high_degree_threshold) {
-	   		  		edge_t edge = edge_t(u, v);
-	   		  		h2h_file.write((char*)&edge, sizeof(edge_t));
-	   		  		++num_h2h_edges;
+	   		  		save_h2h_edge(edge_t(u, v));
 	   			}
 	   		}
 	   		if (write_low_degree_edgelist && low_degree) {
@@ -306,7 +303,8 @@ eid_t mem_graph_t<adj_t>::stream_build(std::ifstream &fin, eid_t num_edges, dens
 	}
 
 	LOG(INFO) << "Edges to a high-degree vertex: " << savings << std::endl;
-	LOG(INFO) << "Edges between two high-degree vertices: " << num_h2h_edges << std::endl;
+	LOG(INFO) << "Edges between two high-degree vertices: " << num_h2h_edges
+	          << (h2h_in_memory ? " (kept in memory)" : " (on disk)") << std::endl;
 
 	// write the number of vertices and number of low-degree edges to the low-file
 	eid_t num_low_edges = num_all_edges - num_h2h_edges;
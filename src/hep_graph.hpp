@@ -1,6 +1,7 @@
 #ifndef HEP_GRAPH_HPP
 #define HEP_GRAPH_HPP
 
+#include <algorithm>
 #include <utility>
 
 #include "common.hpp"
@@ -100,10 +101,13 @@ public:
     std::fstream h2h_file; // file that keeps edges between two high-degree vertices on external memory
     std::fstream low_degree_file; // file that keeps edges incident to a low-degree vertex on external memory
     eid_t num_h2h_edges;
+    std::vector<edge_t> h2h_edges; // edges between two high-degree vertices, when they fit in memory
+    eid_t h2h_buffer_limit; // how many h2h edges may be kept in memory before falling back to h2h_file
+    bool h2h_in_memory;
 
 
 public:
-    mem_graph_t() : num_vertices(0), nedges(0), neighbors(NULL), high_degree_factor(0), high_degree_threshold(0), num_h2h_edges(0) {  }
+    mem_graph_t() : num_vertices(0), nedges(0), neighbors(NULL), high_degree_factor(0), high_degree_threshold(0), num_h2h_edges(0), h2h_buffer_limit(0), h2h_in_memory(true) {  }
 
     mem_graph_t(mem_graph_t&& other) noexcept
         : num_vertices(std::exchange(other.num_vertices, 0)),
@@ -114,7 +118,10 @@ public:
           high_degree_threshold(std::exchange(other.high_degree_threshold, 0)),
           h2h_file(std::move(other.h2h_file)),
           low_degree_file(std::move(other.low_degree_file)),
-          num_h2h_edges(std::exchange(other.num_h2h_edges, 0)) {
+          num_h2h_edges(std::exchange(other.num_h2h_edges, 0)),
+          h2h_edges(std::move(other.h2h_edges)),
+          h2h_buffer_limit(std::exchange(other.h2h_buffer_limit, 0)),
+          h2h_in_memory(std::exchange(other.h2h_in_memory, true)) {
     }
 
     mem_graph_t& operator=(mem_graph_t&& other) noexcept 
@@ -128,6 +135,9 @@ public:
         h2h_file = std::move(other.h2h_file);
         low_degree_file = std::move(other.low_degree_file);
         num_h2h_edges = std::exchange(other.num_h2h_edges, 0);
+        h2h_edges = std::move(other.h2h_edges);
+        h2h_buffer_limit = std::exchange(other.h2h_buffer_limit, 0);
+        h2h_in_memory = std::exchange(other.h2h_in_memory, true);
         return *this;
     }
 
@@ -146,6 +156,27 @@ public:
 
     eid_t num_edges() const { return nedges; }
 
+    // keeps the h2h edge in memory until h2h_buffer_limit is exceeded,
+    // then moves the buffered edges to h2h_file and keeps writing there
+    void save_h2h_edge(const edge_t &edge)
+    {
+        if (h2h_in_memory && h2h_edges.size() < h2h_buffer_limit) {
+            if (h2h_edges.size() == h2h_edges.capacity()) {
+                // doubles as push_back would, but never past the limit the -memsize budget left room for
+                h2h_edges.reserve(std::min<eid_t>(h2h_buffer_limit, std::max<eid_t>(2 * h2h_edges.size(), 1024)));
+            }
+            h2h_edges.push_back(edge);
+        } else {
+            if (h2h_in_memory) {
+                h2h_file.write((char *)h2h_edges.data(), sizeof(edge_t) * h2h_edges.size());
+                std::vector<edge_t>().swap(h2h_edges);
+                h2h_in_memory = false;
+            }
+            h2h_file.write((char *)&edge, sizeof(edge_t));
+        }
+        ++num_h2h_edges;
+    }
+
     eid_t stream_build(std::ifstream &fin, eid_t num_edges, dense_bitset &is_high_degree, dense_bitset &has_high_degree_neighbor, std::vector<vid_t> &count, bool write_low_degree_edgelist);
 
     mem_adjlist_t<TAdj> &operator[](eid_t idx) { return vdata[idx]; };
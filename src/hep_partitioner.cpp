@@ -5,15 +5,6 @@ template <typename TAdj>
 HepPartitioner<TAdj>::HepPartitioner(std::string basefilename, bool need_k_split)
     : basefilename(basefilename), rd(), gen(rd())
 {
-	if (need_k_split || FLAGS_write == "none") {
-        writer = std::make_unique<EdgepartWriterBase<vid_t, bid_t>>(basefilename);
-    } else {
-        if (FLAGS_write == "onefile") {
-            writer = std::make_unique<EdgepartWriterOnefile<vid_t, bid_t>>(basefilename);
-        } else if (FLAGS_write == "multifile") {
-            writer = std::make_unique<EdgepartWriterMultifile<vid_t, bid_t>>(basefilename);
-        }
-    }
     Timer convert_timer;
     convert_timer.start();
 
@@ -53,16 +44,31 @@ HepPartitioner<TAdj>::HepPartitioner(std::string basefilename, bool need_k_split
     occupied.assign(num_partitions, 0);  //Will count how many edges are in one partition
 
     is_boundarys.assign(num_partitions, dense_bitset(num_vertices)); //shows if a vertex is in S of a bucket
+    hdrf_kernel = select_hdrf_kernel();
     is_in_a_core = dense_bitset(num_vertices); //Shows if a vertex is in ANY C
     is_high_degree = dense_bitset(num_vertices); // whether a vertex has a high degree and is handled differently
     has_high_degree_neighbor = dense_bitset(num_vertices); // whether the vertex has a high degree neighbor (important in assign_remaining function)
 
+    high_degree_factor = FLAGS_hdf;
+    if (FLAGS_memsize > 0) {
+        fit_memory_budget();
+        FLAGS_hdf = high_degree_factor; // the output name carries the chosen factor
+    }
+
+    if (need_k_split || FLAGS_write == "none") {
+        writer = std::make_unique<EdgepartWriterBase<vid_t, bid_t>>(basefilename);
+    } else {
+        if (FLAGS_write == "onefile") {
+            writer = std::make_unique<EdgepartWriterOnefile<vid_t, bid_t>>(basefilename);
+        } else if (FLAGS_write == "multifile") {
+            writer = std::make_unique<EdgepartWriterMultifile<vid_t, bid_t>>(basefilename);
+        }
+    }
+
     Timer read_timer;
     read_timer.start();
     LOG(INFO) << "loading and constructing...";
 
-    high_degree_factor = FLAGS_hdf;
-
     load_in_memory(basefilename, fin);
     capacity_in_memory = ((double)num_edges - num_h2h_edges) * BALANCE_RATIO / num_partitions + 1;
 
@@ -146,6 +152,58 @@ void HepPartitioner<TAdj>::compute_stats()
 	}
 }
 
+// picks the highest high-degree threshold whose in-memory state fits into -memsize
+template <typename TAdj>
+void HepPartitioner<TAdj>::fit_memory_budget()
+{
+	std::vector<vid_t> sorted_degrees(num_vertices);
+	std::ifstream degree_file(degree_name(basefilename), std::ios::binary);
+	degree_file.read((char *)&sorted_degrees[0], num_vertices * sizeof(vid_t));
+	degree_file.close();
+	std::sort(sorted_degrees.begin(), sorted_degrees.end());
+
+	// independent of the threshold: adjacency index, degrees, build offsets and index,
+	// min heap (plus the copy taken while cleaning up), vertex bitsets and the stream buffers
+	double fixed_bytes = (double)num_vertices * (sizeof(mem_adjlist_t<TAdj>) + 2 * sizeof(vid_t) + sizeof(eid_t)
+	                                             + 2 * sizeof(std::pair<vid_t, vid_t>) + sizeof(vid_t))
+	                     + (num_partitions + 3) * (num_vertices / 8.0)
+	                     + std::max(100000 * sizeof(edge_t), EdgeStream::memory_bytes());
+	// what the process already holds (binary, libraries, buffers) counts against the budget
+	fixed_bytes += peak_memory_mb() * 1024 * 1024;
+	double budget_bytes = FLAGS_memsize * 1024.0 * 1024.0;
+
+	// a threshold t keeps every vertex of degree <= t in the CSR, so only the
+	// distinct degrees are candidates
+	vid_t threshold = 0;
+	eid_t csr_entries = 0;
+	for (vid_t i = 0; i < num_vertices;) {
+		vid_t d = sorted_degrees[i];
+		eid_t entries = csr_entries;
+		for (; i < num_vertices && sorted_degrees[i] == d; ++i) {
+			entries += d;
+		}
+		if (fixed_bytes + entries * sizeof(TAdj) > budget_bytes) {
+			break;
+		}
+		threshold = d;
+		csr_entries = entries;
+	}
+	if (fixed_bytes > budget_bytes) {
+		LOG(WARNING) << "memsize " << FLAGS_memsize << " MB is below the fixed cost of "
+		             << fixed_bytes / 1024 / 1024 << " MB, streaming all edges";
+	}
+
+	// stream_build truncates average_degree * hdf, aim at the middle of [t, t + 1)
+	high_degree_factor = (threshold + 0.5) / average_degree;
+	predicted_memory_mb = (fixed_bytes + csr_entries * sizeof(TAdj)) / 1024 / 1024;
+	// what is left of the budget keeps the h2h edges in memory
+	double left_bytes = budget_bytes - fixed_bytes - csr_entries * sizeof(TAdj);
+	mem_graph.h2h_buffer_limit = left_bytes > 0 ? left_bytes / (sizeof(edge_t) + sizeof(bid_t)) : 0;
+	LOG(INFO) << "memsize: " << FLAGS_memsize << " MB, high degree threshold: " << threshold
+	          << " (hdf " << high_degree_factor << "), in-memory edges: " << csr_entries / 2.0 / num_edges;
+	LOG(INFO) << "predicted peak memory: " << predicted_memory_mb << " MB";
+}
+
 template <typename TAdj>
 void HepPartitioner<TAdj>::load_in_memory(std::string basefilename, std::ifstream &fin) 
 {
@@ -157,6 +215,9 @@ void HepPartitioner<TAdj>::load_in_memory(std::string basefilename, std::ifstrea
 	mem_graph.resize(num_vertices);
 	num_h2h_edges = mem_graph.stream_build(fin, num_edges, is_high_degree, has_high_degree_neighbor, degrees, write_low_degree_edgelist);
 	mem_graph.h2h_file.close(); //flushed
+	if (mem_graph.h2h_in_memory) {
+		predicted_memory_mb += num_h2h_edges * (sizeof(edge_t) + sizeof(bid_t)) / 1024.0 / 1024;
+	}
 	if (write_low_degree_edgelist) {
 		mem_graph.low_degree_file.close(); //flushed
 	}
@@ -168,6 +229,10 @@ void HepPartitioner<TAdj>::in_memory_assign_remaining()
 {
 
 	LOG(INFO) << "Assigned edges before assign_remaining: " << assigned_edges << std::endl;
+	// from here on only HDRF places edges; give it the vertex-major replicas
+	// and the current min / max partition sizes
+	replicas.build(is_boundarys);
+	loads.assign(occupied);
 
 	for (vid_t vid = 0; vid < num_vertices; ++vid) {
 		if (!is_in_a_core.get(vid)) {
@@ -198,6 +263,7 @@ void HepPartitioner<TAdj>::in_memory_assign_remaining()
 	LOG(INFO) << "Assigning edges between high-degree vertices" << std::endl;
 
     hdrf_streaming();
+    is_boundarys = replicas.release_bitsets(num_partitions);
 }
 
 template <typename TAdj>
@@ -205,56 +271,29 @@ void HepPartitioner<TAdj>::hdrf_streaming()
 {
 	LOG(INFO) << "Streaming using HDRF algorithm." << std::endl;
 	// assign the edges between two high degree vertices
-
-	mem_graph.h2h_file.open(h2hedgelist_name(basefilename), std::ios_base::binary | std::ios_base::in);
-	mem_graph.h2h_file.seekg(0, std::ios::beg);
-
-	std::vector<edge_t> stream_edges; // temporary buffer to read edges from file
-	eid_t chunk_size;
-	eid_t left_h2h_edges = mem_graph.num_h2h_edges;
     eid_t id_h2h_edges = 0;
 
-	if (left_h2h_edges >= 100000) {
-		chunk_size = 100000; // batch read of so many edges
-	} else {
-		chunk_size = left_h2h_edges;
-	}
-	stream_edges.resize(chunk_size);
+	auto assign_h2h_edge = [&](const edge_t &e) {
+		bucket = best_scored_partition(e.first, e.second); // according to HDRF scoring
+		assign_edge(bucket, e.first, e.second, id_h2h_edges++);
+	};
 
+	if (mem_graph.h2h_in_memory) {
+		for (const edge_t &e : mem_graph.h2h_edges) {
+			assign_h2h_edge(e);
+		}
+		return;
+	}
 
-    /*
-    * init min_size
-    */
-    min_size = *std::min_element(occupied.begin(), occupied.end());
+	EdgeStream stream(h2hedgelist_name(basefilename), 0, mem_graph.num_h2h_edges);
+	const edge_t *stream_edges;
+	eid_t chunk_size;
 
-	while (left_h2h_edges > 0) { // edges to be read
-		mem_graph.h2h_file.read((char *)&stream_edges[0], sizeof(edge_t) * chunk_size);
+	while ((chunk_size = stream.next(stream_edges)) > 0) {
 		for (eid_t i = 0; i < chunk_size; ++i) {
-			bucket = best_scored_partition(stream_edges[i].first, stream_edges[i].second); // according to HDRF scoring
-			assign_edge(bucket, stream_edges[i].first, stream_edges[i].second, id_h2h_edges++);
-
-			if (occupied[bucket] > max_size) {
-				max_size = occupied[bucket];
-			}
-			if (occupied[bucket] == min_size) {
-				bid_t min_sized_bucket_count = 0;
-				for (bid_t b = 0; b < num_partitions; ++b) {
-					if (occupied[b] == min_size) {
-						++min_sized_bucket_count;
-					}
-				}
-				if (min_sized_bucket_count == 1) {
-					++min_size;
-				}
-			}
-		}
-
-		left_h2h_edges -= chunk_size;
-		if (left_h2h_edges < chunk_size) { // adapt chunk size for last batch read
-		    chunk_size = left_h2h_edges;
+			assign_h2h_edge(stream_edges[i]);
 		}
 	}
-    mem_graph.h2h_file.close();
 }
 
 template <typename TAdj>
@@ -370,45 +409,11 @@ void HepPartitioner<TAdj>::partition_in_memory()
 
 }
 
-template <typename TAdj>
-double HepPartitioner<TAdj>::compute_partition_score(vid_t u, vid_t v, bid_t bucket_id) 
-{
-	if (occupied[bucket_id] >= capacity) {
-		return -1.0; // partition is full, do not choose it
-	}
-	vid_t degree_u = degrees[u];
-	vid_t degree_v = degrees[v];
-	vid_t sum = degree_u + degree_v;
-	double gu = 0.0, gv = 0.0;
-	if (is_boundarys[bucket_id].get(u)) {
-		gu = degree_u;
-		gu /= sum;
-		gu = 1 + (1 - gu);
-	}
-	if (is_boundarys[bucket_id].get(v)) {
-		 gv = degree_v;
-		 gv /= sum;
-		 gv = 1 + (1 - gv);
-	}
-
-	double bal = (max_size - occupied[bucket_id]) / (1.0 + max_size - min_size);
-
-	double score = gu + gv + lambda * bal;
-	return score;
-}
-
 template <typename TAdj>
 bid_t HepPartitioner<TAdj>::best_scored_partition(vid_t u, vid_t v) 
 {
-	double best_score = -1.0;
-	bid_t best_partition = kInvalidBid;
-	for (bid_t i = 0; i < num_partitions; ++i) {
-		double score = compute_partition_score(u, v, i);
-		if (score > best_score) {
-			best_score = score;
-			best_partition = i;
-		}
-	}
+	hdrf_edge_t e(replicas, u, v, degrees[u], degrees[v], lambda, loads.max(), loads.min(), capacity);
+	bid_t best_partition = hdrf_kernel(e, loads.data(), num_partitions);
     if (best_partition == kInvalidBid) {
         best_partition = gen() % num_partitions;
     }
@@ -438,6 +443,10 @@ void HepPartitioner<TAdj>::split()
 
     total_time.stop();
     LOG(INFO) << "partitioning time: " << partition_time.get_time();
+    if (FLAGS_memsize > 0) {
+        LOG(INFO) << "predicted peak memory: " << predicted_memory_mb << " MB, "
+                  << "actual peak memory: " << peak_memory_mb() << " MB";
+    }
 
     /*
      * compute some stats about the partitioned graph (for further analysis)
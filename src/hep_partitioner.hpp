@@ -6,6 +6,9 @@
 
 #include "hep_min_heap.hpp"
 #include "dense_bitset.hpp"
+#include "edge_stream.hpp"
+#include "hdrf_score.hpp"
+#include "load_tracker.hpp"
 #include "part_writer.hpp"
 #include "partitioner.hpp"
 #include "hep_graph.hpp"
@@ -29,19 +32,24 @@ private:
     eid_t capacity;
     eid_t capacity_in_memory; // capacity per partition of in memory partitioning
     eid_t num_invalidated_edges; // number of edges removed in clean up phase overall
-    eid_t min_size = 0; // currently smallest partition
-    eid_t max_size = 0; // currently largest partition
 
     // whether edges incident to a low-degree vertex should be written out to a file. 
     // useful if this sub-graph should be analyzed separately.
     bool write_low_degree_edgelist = false; 
 
     double high_degree_factor;
+    double predicted_memory_mb = 0; // in-memory footprint predicted from -memsize
     HepMinHeap<vid_t, vid_t> min_heap;
     dense_bitset is_in_a_core;
     dense_bitset is_high_degree;
     dense_bitset has_high_degree_neighbor;
 
+    // the replicas of the HDRF phase, is_boundarys is transposed into them
+    // when it starts and back when it ends
+    replica_masks_t replicas;
+    LoadTracker loads;        // occupied with its min and max, also from the HDRF phase on
+    hdrf_kernel_t hdrf_kernel;
+
     /// @note For derived classes of a class template, 
     /// if you want to inherit member variables of the base class, 
     /// you need to use the using keyword to import member variables of the base class
@@ -245,6 +253,17 @@ private:
         return vid != num_vertices;
     }
 
+    void add_replicas(bid_t bucket, vid_t u, vid_t v)
+    {
+        if (replicas.empty()) {
+            is_boundarys[bucket].set_bit_unsync(u);
+            is_boundarys[bucket].set_bit_unsync(v);
+        } else {
+            replicas.set(u, bucket);
+            replicas.set(v, bucket);
+        }
+    }
+
     bool check_edge_hybrid()
     {
         std::vector<dense_bitset> dbitsets(num_partitions, dense_bitset(num_vertices));
@@ -264,11 +283,11 @@ private:
         return true;
     }
 
+    void fit_memory_budget();
     void load_in_memory(std::string basefilename, std::ifstream &fin);
     void partition_in_memory();
     void in_memory_assign_remaining();
 
-    double compute_partition_score(vid_t u, vid_t v, bid_t bucket_id); // returns HDRF score for edge (u,v) on partition <bucket_id>
     bid_t best_scored_partition(vid_t u, vid_t v); // returns bucket id where score is best for edge (u,v)
 
     void compute_stats();
@@ -295,8 +314,10 @@ void HepPartitioner<adj_t>::assign_edge(bid_t cbucket, vid_t from, adj_t& v_e)
     writer->save_edge(from, v_e.vid, cbucket);
     ++assigned_edges;
     ++occupied[cbucket];
-    is_boundarys[cbucket].set_bit_unsync(from);
-    is_boundarys[cbucket].set_bit_unsync(v_e.vid);
+    if (!loads.empty()) {
+        loads.increment(cbucket);
+    }
+    add_replicas(cbucket, from, v_e.vid);
 }
 
 template <> 
@@ -305,8 +326,10 @@ void HepPartitioner<adj_with_bid_t>::assign_edge(bid_t cbucket, vid_t from, adj_
     writer->save_edge(from, v_e.vid, cbucket);
     ++assigned_edges;
     ++occupied[cbucket];
-    is_boundarys[cbucket].set_bit_unsync(from);
-    is_boundarys[cbucket].set_bit_unsync(v_e.vid);
+    if (!loads.empty()) {
+        loads.increment(cbucket);
+    }
+    add_replicas(cbucket, from, v_e.vid);
 
     v_e.bid = cbucket;
 }
@@ -317,8 +340,10 @@ void HepPartitioner<adj_t>::assign_edge(bid_t cbucket, vid_t from, vid_t to, eid
     writer->save_edge(from, to, cbucket);
     ++assigned_edges;
     ++occupied[cbucket];
-    is_boundarys[cbucket].set_bit_unsync(from);
-    is_boundarys[cbucket].set_bit_unsync(to);
+    if (!loads.empty()) {
+        loads.increment(cbucket);
+    }
+    add_replicas(cbucket, from, to);
 }
 
 template <> 
@@ -327,8 +352,10 @@ void HepPartitioner<adj_with_bid_t>::assign_edge(bid_t cbucket, vid_t from, vid_
     writer->save_edge(from, to, cbucket);
     ++assigned_edges;
     ++occupied[cbucket];
-    is_boundarys[cbucket].set_bit_unsync(from);
-    is_boundarys[cbucket].set_bit_unsync(to);
+    if (!loads.empty()) {
+        loads.increment(cbucket);
+    }
+    add_replicas(cbucket, from, to);
     
     edgelist2bucket[edge_id] = cbucket;
 }
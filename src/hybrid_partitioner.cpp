@@ -1,3 +1,5 @@
+#include <omp.h>
+
 #include "hybrid_partitioner.hpp"
 #include "conversions.hpp"
 
@@ -72,40 +74,72 @@ void HybridPartitioner::split()
 
     LOG(INFO) << "partitioning...";
     partition_time.start();
+    if (FLAGS_threads > 1) {
+        parallel_split();
+        return;
+    }
 
-    std::vector<edge_t> stream_edges; // temporary buffer to read edges from file
-    eid_t chunk_size = std::min(num_edges, (eid_t)100000);
-    eid_t num_remaining_edges = num_edges; // number of edges to be read from file
-
-    std::ifstream fin(binedgelist_name(basefilename),
-                      std::ios::binary | std::ios::ate);
-    fin.seekg(sizeof(num_vertices) + sizeof(num_edges), std::ios::beg); 
-
-    stream_edges.resize(chunk_size);
+    EdgeStream stream(binedgelist_name(basefilename), sizeof(num_vertices) + sizeof(num_edges), num_edges);
+    const edge_t *stream_edges;
+    eid_t chunk_size;
 
     eid_t eid = 0; // number of edges read from file
-    while (num_remaining_edges > 0) { // edges to be read
-        fin.read((char *)&stream_edges[0], sizeof(edge_t) * chunk_size);
+    while ((chunk_size = stream.next(stream_edges)) > 0) {
         for (eid_t i = 0; i < chunk_size; ++i, ++eid) {
             if (eid % 50000000 == 0) {
                 LOG(INFO) << "Processing edges " << eid;
             }
             const auto& [uid, vid] = stream_edges[i];
-            if (degrees[vid] < degree_threshold) {
-                assign_edge(vid % num_partitions, uid, vid, eid);
-            } else {
-                assign_edge(uid % num_partitions, uid, vid, eid);
+            assign_edge(bucket_of(uid, vid), uid, vid, eid);
+        }
+    }
+
+    partition_time.stop();
+
+    LOG(INFO) << "partition time: " << partition_time.get_time();
+
+    total_time.stop();
+    LOG(INFO) << "total partition time: " << total_time.get_time();
+    calculate_stats();
+}
+
+// Same slicing as the parallel DBH: private counters and output buffers,
+// shared replica bits.
+void HybridPartitioner::parallel_split()
+{
+    const int num_threads = FLAGS_threads;
+    LOG(INFO) << "parallel Hybrid with " << num_threads << " threads";
+    EdgeMap edge_map(binedgelist_name(basefilename), sizeof(num_vertices) + sizeof(num_edges), num_edges);
+    const edge_t *mapped_edges = edge_map.edges();
+
+    #pragma omp parallel num_threads(num_threads)
+    {
+        std::vector<eid_t> local_occupied(num_partitions, 0);
+        EdgepartBlockWriter<vid_t, bid_t> block_writer(*writer);
+
+        #pragma omp for schedule(static)
+        for (eid_t eid = 0; eid < num_edges; ++eid) {
+            const auto& [uid, vid] = mapped_edges[eid];
+            bid_t bucket = bucket_of(uid, vid);
+            ++local_occupied[bucket];
+            if (!is_boundarys[bucket].get(uid)) {
+                is_boundarys[bucket].set_bit(uid);
             }
+            if (!is_boundarys[bucket].get(vid)) {
+                is_boundarys[bucket].set_bit(vid);
+            }
+            block_writer.save_edge(uid, vid, bucket);
         }
 
-        num_remaining_edges -= chunk_size;
-        if (num_remaining_edges < chunk_size) { // adapt chunk size for last batch read
-            chunk_size = num_remaining_edges;
+        block_writer.flush();
+        #pragma omp critical
+        for (bid_t b = 0; b < num_partitions; ++b) {
+            occupied[b] += local_occupied[b];
         }
     }
+    assigned_edges = num_edges;
 
     partition_time.stop();
-
     LOG(INFO) << "partition time: " << partition_time.get_time();
 
     total_time.stop();
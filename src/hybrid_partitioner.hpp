@@ -5,6 +5,7 @@
 #include <random>
 
 #include "dense_bitset.hpp"
+#include "edge_stream.hpp"
 #include "part_writer.hpp"
 #include "partitioner.hpp"
 #include "ne_graph.hpp"
@@ -41,6 +42,14 @@ private:
         ++occupied[bucket];
     }
 
+    /// low-degree targets are hashed by the target, high-degree ones by the source
+    bid_t bucket_of(vid_t uid, vid_t vid) const
+    {
+        return (degrees[vid] < degree_threshold ? vid : uid) % num_partitions;
+    }
+
+    void parallel_split(); // -threads > 1
+
 public:
     HybridPartitioner(std::string basefilename, bool need_k_split);
     void split();
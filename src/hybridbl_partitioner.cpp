@@ -1,3 +1,5 @@
+#include <omp.h>
+
 #include "hybridbl_partitioner.hpp"
 #include "conversions.hpp"
 
@@ -65,6 +67,7 @@ HybridBLPartitioner<TAdj>::HybridBLPartitioner(std::string basefilename, bool ne
     Q.resize(num_partitions);
     V = dense_bitset(num_vertices);
     super.resize(num_vertices, kInvalidVid);
+    root_bucket.assign(num_vertices, kInvalidBid);
     free_vertex.resize(num_partitions, 0);
     std::iota(free_vertex.begin(), free_vertex.end(), 0);
 
@@ -99,41 +102,53 @@ void HybridBLPartitioner<TAdj>::split()
 
     LOG(INFO) << "partitioning...";
     compute_timer.start();
-    
-    // V is not empty
-    while (true) {
-        bool stop = true;
-        for (bid_t m = 0; m < num_partitions; ++m) {
-            if (Q[m].empty()) {
-                bool has_free_vertex = get_free_vertex(m);
-                stop &= !has_free_vertex;
-                if (!has_free_vertex) {
-                    continue;
-                }
-
-                auto vid = free_vertex[m];
-                // if (degrees[vid] < degree_threshold) {
-                if (adj_in[vid].size() < degree_threshold && super[vid] == kInvalidVid) {
-                    // assert(super[vid] == kInvalidVid);
-                    init_fusion(m, vid, 0);
 
-                // } else if (degrees[vid] >= degree_threshold) {
-                } else if (adj_in[vid].size() >= degree_threshold) {
-                    fission(m, vid);
-                }
-            } else {
-                stop = false;
-                auto [uid, root, dist] = Q[m].front();
-                Q[m].pop();
-                if (dist < gamma && super[uid] == kInvalidVid) {
-                // if (root_assigned[root] < fusion_threshold && super[uid] == kInvalidVid) {
-                    fusion(m, uid, root, dist);
+    // machine m runs on thread m % num_threads; the threads share the
+    // vertex and edge state, edges are claimed with a CAS
+    const int num_threads = std::min<int>(FLAGS_threads, num_partitions);
+    LOG(INFO) << "machines run on " << num_threads << " threads";
+    #pragma omp parallel num_threads(num_threads)
+    {
+        worker_t worker(*writer);
+        worker.snapshot.resize(num_partitions);
+        refresh_loads(worker);
+
+        // V is not empty
+        while (true) {
+            bool stop = true;
+            for (uint32_t m = omp_get_thread_num(); m < num_partitions; m += num_threads) {
+                if (Q[m].empty()) {
+                    bool has_free_vertex = get_free_vertex(m);
+                    stop &= !has_free_vertex;
+                    if (!has_free_vertex) {
+                        continue;
+                    }
+
+                    auto vid = free_vertex[m];
+                    // if (degrees[vid] < degree_threshold) {
+                    if (adj_in[vid].size() < degree_threshold && super[vid] == kInvalidVid) {
+                        // assert(super[vid] == kInvalidVid);
+                        init_fusion(worker, m, vid, 0);
+
+                    // } else if (degrees[vid] >= degree_threshold) {
+                    } else if (adj_in[vid].size() >= degree_threshold) {
+                        fission(worker, m, vid);
+                    }
+                } else {
+                    stop = false;
+                    auto [uid, root, dist] = Q[m].front();
+                    Q[m].pop();
+                    if (dist < gamma && super[uid] == kInvalidVid) {
+                        fusion(worker, m, uid, root, dist);
+                    }
                 }
             }
+            if (stop) {
+                break;
+            }
         }
-        if (stop) {
-            break;
-        }
+        worker.block_writer.flush();
+        __sync_fetch_and_add(&assigned_edges, worker.num_assigned);
     }
 
     compute_timer.stop();
@@ -148,40 +163,26 @@ void HybridBLPartitioner<TAdj>::split()
     //     LOG(INFO) << b << ": " << fusion_occupy[b] << '\t' << fission_occupy[b];
     //     sum += fusion_occupy[b] + fission_occupy[b];
     // }
-    // eid_t max_assigned = 0;
-    // for (const auto& [vid, assigned] : root_assigned) {
-    //     // LOG(INFO) << vid << ' ' << assigned;
-    //     max_assigned = std::max(assigned, max_assigned);
-    // }
-    // LOG(INFO) << "max_assigned: " << max_assigned;
 }
 
 template <typename TAdj>
-void HybridBLPartitioner<TAdj>::init_fusion(bid_t machine, vid_t vid, vid_t dist)
+void HybridBLPartitioner<TAdj>::init_fusion(worker_t &worker, bid_t machine, vid_t vid, vid_t dist)
 {
     super[vid] = vid;
-    bid_t candidate = kInvalidBid;
-    eid_t candidate_size = std::numeric_limits<eid_t>::max();
-    for (bid_t b = 0; b < num_partitions; ++b) {
-        if (occupied[b] < candidate_size) {
-            candidate = b;
-            candidate_size = occupied[b];
-        }
-    }
-    root_bucket[vid] = candidate;
-    fusion(machine, vid, vid, dist);
+    root_bucket[vid] = worker.loads.argmin();
+    fusion(worker, machine, vid, vid, dist);
 }
 
 template <typename TAdj>
-void HybridBLPartitioner<TAdj>::fusion(bid_t machine, vid_t vid, vid_t root, vid_t dist)
+void HybridBLPartitioner<TAdj>::fusion(worker_t &worker, bid_t machine, vid_t vid, vid_t root, vid_t dist)
 {
     // LOG(INFO) << "Fussion function begin(vid, dist, ind): " 
     //     << vid << ' ' << dist << ' ' 
     //     << adj_in[vid].size() << ' ' << adj_out[vid].size();
-    V.set(vid, 1);
-    vid_t current_super = super[root];
-    assert(super[root] == root);
-    super[vid] = current_super;
+    V.set_bit(vid);
+    // root may have been fused into another root by a concurrent machine
+    // since, so it is taken as the super vertex itself
+    super[vid] = root;
     bid_t current_super_bid = root_bucket[root];
     for (int direction = 0; direction < 2; ++direction) {
         adjlist_t &neighbors = direction ? adj_out[vid] : adj_in[vid];
@@ -192,9 +193,10 @@ void HybridBLPartitioner<TAdj>::fusion(bid_t machine, vid_t vid, vid_t root, vid
 
             vid_t &uid = direction ? edges[eid].second : edges[eid].first;
 
-            assign_edge(current_super_bid, direction ? vid : uid, direction ? uid : vid, eid);
+            if (!assign_edge(worker, current_super_bid, direction ? vid : uid, direction ? uid : vid, eid)) {
+                continue;
+            }
             // ++fusion_occupy[current_super_bid];
-            // ++root_assigned[root];
             Q[machine].push({uid, root, dist + 1});
         }
     }
@@ -207,9 +209,9 @@ void HybridBLPartitioner<TAdj>::fusion(bid_t machine, vid_t vid, vid_t root, vid
 }
 
 template <typename TAdj>
-void HybridBLPartitioner<TAdj>::fission(bid_t machine, vid_t vid)
+void HybridBLPartitioner<TAdj>::fission(worker_t &worker, bid_t machine, vid_t vid)
 {
-    V.set(vid, 1);
+    V.set_bit(vid);
     for (int direction = 1; direction < 2; ++direction) {
         adjlist_t &neighbors = direction ? adj_out[vid] : adj_in[vid];
         for (vid_t i = 0; i < neighbors.size(); ++i) {
@@ -218,7 +220,7 @@ void HybridBLPartitioner<TAdj>::fission(bid_t machine, vid_t vid)
             if (edgelist2bucket[eid] != kInvalidBid) continue;
 
             vid_t &uid = direction ? edges[eid].second : edges[eid].first;
-            assign_edge(uid % num_partitions, direction ? vid : uid, direction ? uid : vid, eid);
+            assign_edge(worker, uid % num_partitions, direction ? vid : uid, direction ? uid : vid, eid);
             // ++fission_occupy[uid % num_partitions];
         }
     }
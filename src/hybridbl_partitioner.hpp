@@ -4,9 +4,9 @@
 #include <memory>
 #include <queue>
 #include <random>
-#include <unordered_map>
 
 #include "dense_bitset.hpp"
+#include "load_tracker.hpp"
 #include "part_writer.hpp"
 #include "partitioner.hpp"
 #include "ne_graph.hpp"
@@ -33,8 +33,7 @@ private:
 
     std::vector<eid_t> fission_occupy;
     std::vector<eid_t> fusion_occupy;
-    std::unordered_map<vid_t, eid_t> root_assigned;
-    std::unordered_map<vid_t, bid_t> root_bucket;
+    std::vector<bid_t> root_bucket; // bucket of each fusion root
 
     // degree threshold 
     vid_t degree_threshold = 100;
@@ -49,6 +48,17 @@ private:
     // vertex id, dist from super
     std::vector<std::queue<std::tuple<vid_t, vid_t, vid_t>>> Q;
 
+    // state of the thread that runs a set of machines
+    struct worker_t {
+        static const eid_t kRefreshInterval = 1024;
+        LoadTracker loads; // occupied as of the last refresh, plus own edges
+        std::vector<eid_t> snapshot;
+        eid_t num_assigned = 0;
+        EdgepartBlockWriter<vid_t, bid_t> block_writer;
+
+        worker_t(EdgepartWriterBase<vid_t, bid_t> &writer) : block_writer(writer) {}
+    };
+
     using AdjListEPartitioner<TAdj>::total_time;
     using AdjListEPartitioner<TAdj>::num_vertices;
     using AdjListEPartitioner<TAdj>::num_edges;
@@ -64,15 +74,30 @@ private:
     bool need_k_split;
     std::unique_ptr<EdgepartWriterBase<vid_t, bid_t>> writer = nullptr;
 
-    void assign_edge(bid_t bucket, vid_t from, vid_t to, eid_t edge_id)
+    void refresh_loads(worker_t &worker)
+    {
+        for (bid_t b = 0; b < num_partitions; ++b) {
+            worker.snapshot[b] = __atomic_load_n(&occupied[b], __ATOMIC_RELAXED);
+        }
+        worker.loads.assign(worker.snapshot);
+    }
+
+    /// claims the edge with a CAS, so that only one machine assigns it
+    /// @return false if another machine got the edge first
+    bool assign_edge(worker_t &worker, bid_t bucket, vid_t from, vid_t to, eid_t edge_id)
     {
-        writer->save_edge(from, to, bucket);
-        CHECK_EQ(edgelist2bucket[edge_id], kInvalidBid);
-        edgelist2bucket[edge_id] = bucket;
-        is_boundarys[bucket].set_bit_unsync(from);
-        is_boundarys[bucket].set_bit_unsync(to);
-        ++assigned_edges;
-        ++occupied[bucket];
+        if (!__sync_bool_compare_and_swap(&edgelist2bucket[edge_id], kInvalidBid, bucket)) {
+            return false;
+        }
+        worker.block_writer.save_edge(from, to, bucket);
+        is_boundarys[bucket].set_bit(from);
+        is_boundarys[bucket].set_bit(to);
+        __sync_fetch_and_add(&occupied[bucket], 1);
+        worker.loads.increment(bucket);
+        if (++worker.num_assigned % worker_t::kRefreshInterval == 0) {
+            refresh_loads(worker);
+        }
+        return true;
     }
 
     // bool get_free_vertex_by_rand()
@@ -99,9 +124,9 @@ private:
         return true;
     }
 
-    void init_fusion(bid_t machine, vid_t vid, vid_t dist);
-    void fusion(bid_t machine, vid_t vid, vid_t root, vid_t dist);
-    void fission(bid_t machine, vid_t vid);
+    void init_fusion(worker_t &worker, bid_t machine, vid_t vid, vid_t dist);
+    void fusion(worker_t &worker, bid_t machine, vid_t vid, vid_t root, vid_t dist);
+    void fission(worker_t &worker, bid_t machine, vid_t vid);
 
 public:
     HybridBLPartitioner(std::string basefilename, bool need_k_split);
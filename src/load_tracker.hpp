@@ -0,0 +1,104 @@
+#ifndef LOAD_TRACKER_HPP
+#define LOAD_TRACKER_HPP
+
+#include <deque>
+#include <algorithm>
+
+#include "common.hpp"
+
+/* Loads of a set of partitions plus the number of partitions at each load,
+ * kept flat for the loads from the smallest to the largest one, indexed by
+ * load - min_load. A +1 / -1 update moves both extremes in O(1), growing or
+ * shrinking the counts by one at either end, instead of a scan over all
+ * partitions. */
+class LoadTracker
+{
+  private:
+    std::vector<eid_t> loads;
+    std::deque<uint32_t> num_with_load;
+    eid_t min_load = 0, max_load = 0, total_load = 0;
+    size_t min_cursor = 0;
+
+    uint32_t &count(eid_t load) { return num_with_load[load - min_load]; }
+
+  public:
+    LoadTracker() {}
+    explicit LoadTracker(size_t num_partitions) { assign(num_partitions); }
+
+    void assign(size_t num_partitions)
+    {
+        assign(std::vector<eid_t>(num_partitions, 0));
+    }
+
+    void assign(const std::vector<eid_t> &initial)
+    {
+        loads = initial;
+        min_cursor = 0;
+        num_with_load.clear();
+        min_load = max_load = total_load = 0;
+        if (loads.empty()) {
+            return;
+        }
+        min_load = *std::min_element(loads.begin(), loads.end());
+        max_load = *std::max_element(loads.begin(), loads.end());
+        num_with_load.assign(max_load - min_load + 1, 0);
+        for (eid_t load : loads) {
+            ++count(load);
+            total_load += load;
+        }
+    }
+
+    void increment(bid_t b)
+    {
+        eid_t load = loads[b]++;
+        if (load == max_load) {
+            num_with_load.push_back(0);
+            ++max_load;
+        }
+        --count(load);
+        ++count(load + 1);
+        if (load == min_load && count(load) == 0) {
+            num_with_load.pop_front();
+            ++min_load;
+        }
+        ++total_load;
+    }
+
+    void decrement(bid_t b)
+    {
+        eid_t load = loads[b]--;
+        if (load == min_load) {
+            num_with_load.push_front(0);
+            --min_load;
+        }
+        --count(load);
+        ++count(load - 1);
+        if (load == max_load && count(load) == 0) {
+            num_with_load.pop_back();
+            --max_load;
+        }
+        --total_load;
+    }
+
+    bool empty() const { return loads.empty(); }
+    size_t size() const { return loads.size(); }
+    eid_t operator[](bid_t b) const { return loads[b]; }
+    const eid_t *data() const { return loads.data(); }
+    const std::vector<eid_t> &values() const { return loads; }
+
+    eid_t min() const { return min_load; }
+    /// A partition at the smallest load. The cursor only moves forward
+    /// (cyclically), which is amortized O(1) as long as loads only grow.
+    bid_t argmin()
+    {
+        while (loads[min_cursor] != min_load) {
+            min_cursor = (min_cursor + 1) % loads.size();
+        }
+        return min_cursor;
+    }
+    eid_t max() const { return max_load; }
+    eid_t total() const { return total_load; }
+    double mean() const { return (double)total_load / loads.size(); }
+};
+
+#endif
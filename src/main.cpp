@@ -2,6 +2,7 @@
 
 #include "fsm_partitioner.hpp"
 #include "ne_partitioner.hpp"
+#include "ne_ooc_partitioner.hpp"
 #include "hep_partitioner.hpp"
 #include "ebv_partitioner.hpp"
 #include "dbh_partitioner.hpp"
@@ -24,12 +25,27 @@ DEFINE_string(filetype, "edgelist",
 DEFINE_string(write, "none", "write out partition result (supports 'none', 'onefile' and 'multifile')");
 DEFINE_int32(k, 1, "split factor, i.e. the exact partitions count / remain partitions");
 DEFINE_bool(fastmerge, false, "use fast merge?");
+DEFINE_string(levels, "", "comma-separated coarser partition counts that FSM also merges down to and writes, each dividing the one before (e.g. -p 128 -levels 64,32,16)");
+DEFINE_string(verify, "full", "check of the FSM partitions against the edges: none, fast (the endpoints of every edge are replicas of its partition) or full (also no replica without an edge)");
+DEFINE_string(fsm_replicas, "bitset", "replica sets of the FSM sub-buckets while merging: bitset (k*p bitsets of |V| bits) or lists (the sorted sub-buckets of every vertex, sized by the replicas)");
+DEFINE_bool(save_split, false, "save the split of fsm methods, so that -merge_only can redo the merge");
+DEFINE_bool(merge_only, false, "load the split saved by -save_split with the same -method, -p and -k, and only merge it");
+DEFINE_double(refine_time, 0, "time budget (in seconds) of the sub-bucket swaps that refine the FSM merge, 0 disables them");
 DEFINE_string(method, "hep",
-              "partition method: hep, ne, sne, fsm_ne, fsm_hep, hdrf, hybrid, ebv and dbh");
+              "partition method: hep, ne, ne_ooc, sne, fsm_ne, fsm_hep, fsm_hdrf, fsm_dbh, fsm_ebv, hdrf, hybrid, ebv, ebv_ooc and dbh");
+DEFINE_int32(ne_cache_mb, 1024, "adjacency block cache size (in MB) of out-of-core NE (ne_ooc)");
+DEFINE_int32(ebv_run_mb, 1024, "sort buffer size (in MB) of out-of-core EBV (ebv_ooc), split between the sorted runs and their merge");
+DEFINE_int32(stream_chunk, 1 << 20, "number of edges per buffer when streaming edges from disk");
+DEFINE_int32(threads, 1, "number of threads of the parallel partitioners (hdrf, dbh, hybrid, hybridbl, fennel) and of the ebv edge and fennel/bpart vertex orderings");
+DEFINE_int32(passes, 1, "number of streaming passes of hdrf, ebv and fennel; later passes restream with the previous assignment as prior");
+DEFINE_string(order, "id", "vertex stream order of fennel and bpart: id, random, bfs, dfs, degree or chunk (shuffled blocks of consecutive ids)");
+DEFINE_int32(seed, 123, "seed of the random and chunk stream orders");
 
 DEFINE_bool(write_low_degree_edgelist, false, "Should the list of edges incident to a low-degree vertex be written out to a file?");
+DEFINE_int32(memsize, 0, "Memory budget in MB for HEP. If set, the highest high-degree threshold whose in-memory part fits the budget is used instead of -hdf");
 DEFINE_double(hdf, 100, "High-degree factor: hdf * average_degree = high-degree threshold (hdth). Called \\tau in the paper. Vertices with than hdth neighbors are treated specially in fast NE");
 DEFINE_double(lambda, 1.1, "Lambda value to weigh in balancing score in streaming partitioning via HDRF");
+DEFINE_string(hdrf_simd, "auto", "SIMD kernel for HDRF scoring in hdrf and hep: auto, avx512, avx2 or none");
 DEFINE_bool(extended_metrics, false, "Display extended metrics in the result");
 DEFINE_bool(random_streaming, false, "Use random streaming instead of HDRF in the second phase of HEP.");
 DEFINE_bool(hybrid_NE, false, "Perform hybrid partitioning in HEP-style, but use NE instead of NE++ for the first phase.");
@@ -50,6 +66,14 @@ int main(int argc, char *argv[])
     }
     google::HandleCommandLineHelpFlags();
 
+    // partition ids run up to p - 1, FSM sub-bucket ids up to k * p - 1
+    CHECK_LE((int64_t)FLAGS_p, (int64_t)kInvalidBid)
+        << "too many partitions for " << sizeof(bid_t) * 8 << "-bit bucket ids, use main_wide";
+    if (FLAGS_method.substr(0, 3) == "fsm" && FLAGS_k > 1) {
+        CHECK_LT((int64_t)FLAGS_p * FLAGS_k, (int64_t)kInvalidBid)
+            << "too many buckets for " << sizeof(bid_t) * 8 << "-bit bucket ids, use main_wide";
+    }
+
     Timer timer;
     timer.start();
 
@@ -62,13 +86,18 @@ int main(int argc, char *argv[])
             method = method.substr(4);
         }
     }
+    CHECK(FLAGS_levels.empty() || partitioner) << "-levels needs an fsm method with -k > 1";
     
     if (method == "ne")
         partitioner = std::make_unique<NePartitioner<adj_t>>(FLAGS_filename, false);
+    else if (method == "ne_ooc")
+        partitioner = std::make_unique<NeOocPartitioner>(FLAGS_filename, false);
     else if (method == "hep")
         partitioner = std::make_unique<HepPartitioner<adj_t>>(FLAGS_filename, false);
     else if (method == "ebv")
         partitioner = std::make_unique<EbvPartitioner>(FLAGS_filename, false);
+    else if (method == "ebv_ooc")
+        partitioner = std::make_unique<EbvPartitioner>(FLAGS_filename, false, true);
     else if (method == "dbh")
         partitioner = std::make_unique<DbhPartitioner>(FLAGS_filename, false);
     else if (method == "hdrf")
@@ -0,0 +1,173 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+
+#include "ne_disk_graph.hpp"
+#include "util.hpp"
+
+const uint64_t kDiskAdjMagic = 0x316a64616b736964; // "diskadj1"
+
+block_cache_t::~block_cache_t()
+{
+    if (fd >= 0)
+        close(fd);
+}
+
+void block_cache_t::open(const std::string &filename, size_t block_size, size_t budget)
+{
+    fd = ::open(filename.c_str(), O_RDONLY);
+    CHECK_GE(fd, 0) << "failed to open " << filename << ": " << strerror(errno);
+    file_size = lseek(fd, 0, SEEK_END);
+
+    this->block_size = block_size;
+    num_slots = std::max((size_t)2, budget / block_size);
+    num_slots = std::min(num_slots, file_size / block_size + 1);
+    pool.resize(num_slots * block_size);
+    free_slots.resize(num_slots);
+    for (size_t i = 0; i < num_slots; ++i)
+        free_slots[i] = num_slots - 1 - i;
+    slot_of.reserve(num_slots);
+}
+
+const char *block_cache_t::get_block(size_t block)
+{
+    auto it = slot_of.find(block);
+    if (it != slot_of.end()) {
+        ++hits;
+        lru.splice(lru.begin(), lru, it->second.first);
+        return &pool[it->second.second * block_size];
+    }
+
+    ++misses;
+    size_t slot;
+    if (!free_slots.empty()) {
+        slot = free_slots.back();
+        free_slots.pop_back();
+    } else {
+        auto victim = slot_of.find(lru.back());
+        slot = victim->second.second;
+        slot_of.erase(victim);
+        lru.pop_back();
+    }
+
+    char *buf = &pool[slot * block_size];
+    size_t offset = block * block_size;
+    size_t len = std::min(block_size, file_size - offset);
+    for (size_t done = 0; done < len;) {
+        ssize_t ret = pread(fd, buf + done, len - done, offset + done);
+        CHECK_GT(ret, 0) << "pread failed: " << strerror(errno);
+        done += ret;
+    }
+    lru.push_front(block);
+    slot_of[block] = std::make_pair(lru.begin(), slot);
+    return buf;
+}
+
+void block_cache_t::read(size_t offset, size_t len, char *out)
+{
+    while (len > 0) {
+        size_t block = offset / block_size, inner = offset % block_size;
+        size_t n = std::min(len, block_size - inner);
+        memcpy(out, get_block(block) + inner, n);
+        out += n;
+        offset += n;
+        len -= n;
+    }
+}
+
+void block_cache_t::prefetch(size_t offset, size_t len)
+{
+    if (len == 0)
+        return;
+    for (size_t block = offset / block_size; block <= (offset + len - 1) / block_size; ++block) {
+        if (!slot_of.count(block)) {
+            // let the kernel start reading while the heap is being processed
+            ++prefetches;
+            posix_fadvise(fd, offset, len, POSIX_FADV_WILLNEED);
+            return;
+        }
+    }
+}
+
+void disk_graph_t::build(const std::string &basefilename, vid_t num_vertices, eid_t num_edges,
+                         const std::vector<vid_t> &degrees, size_t budget)
+{
+    this->num_vertices = num_vertices;
+    index.resize(num_vertices + 1);
+    index[0] = 0;
+    for (vid_t v = 0; v < num_vertices; ++v)
+        index[v + 1] = index[v] + degrees[v];
+    CHECK_EQ(index[num_vertices], 2 * num_edges);
+    // the top bit of an entry marks the direction
+    CHECK_LT(num_vertices, disk_adj_t::kOutBit) << "too many vertices for the disk adjacency";
+
+    struct stat edgelist_st;
+    CHECK_EQ(stat(binedgelist_name(basefilename).c_str(), &edgelist_st), 0)
+        << "failed to stat " << binedgelist_name(basefilename);
+    const disk_adj_header_t header{kDiskAdjMagic, num_vertices, num_edges, (uint64_t)edgelist_st.st_size,
+                                   (uint64_t)edgelist_st.st_mtime};
+
+    std::string filename = diskadj_name(basefilename);
+    disk_adj_header_t existing;
+    std::ifstream fexisting(filename, std::ios::binary | std::ios::ate);
+    bool reuse = fexisting && (size_t)fexisting.tellg() == sizeof(header) + index[num_vertices] * sizeof(disk_adj_t) &&
+                 fexisting.seekg(0).read((char *)&existing, sizeof(existing)) &&
+                 memcmp(&existing, &header, sizeof(header)) == 0;
+    fexisting.close();
+    if (reuse) {
+        LOG(INFO) << "disk adjacency exists, skip building";
+    } else {
+        std::ofstream fout(filename, std::ios::binary);
+        fout.write((const char *)&header, sizeof(header));
+        std::vector<disk_adj_t> buffer;
+        std::vector<eid_t> cursor;
+        const eid_t chunk_size = std::min(num_edges, (eid_t)100000);
+        std::vector<edge_t> stream_edges(chunk_size);
+        size_t max_entries = std::max(budget / sizeof(disk_adj_t), (size_t)1);
+        size_t num_passes = 0;
+
+        for (vid_t lo = 0, hi; lo < num_vertices; lo = hi) {
+            // the range [lo, hi) holds at most max_entries entries unless a
+            // single vertex is larger than that on its own
+            for (hi = lo + 1; hi < num_vertices && index[hi + 1] - index[lo] <= max_entries; ++hi)
+                ;
+            buffer.resize(index[hi] - index[lo]);
+            cursor.assign(index.begin() + lo, index.begin() + hi);
+            ++num_passes;
+
+            std::ifstream fin(binedgelist_name(basefilename), std::ios::binary);
+            fin.seekg(sizeof(vid_t) + sizeof(eid_t), std::ios::beg);
+            eid_t remaining = num_edges, eid = 0;
+            stream_edges.resize(chunk_size);
+            while (remaining > 0) {
+                fin.read((char *)&stream_edges[0], sizeof(edge_t) * stream_edges.size());
+                for (auto &e : stream_edges) {
+                    if (e.first >= lo && e.first < hi) {
+                        auto &entry = buffer[cursor[e.first - lo]++ - index[lo]];
+                        entry.v = e.second | disk_adj_t::kOutBit;
+                        entry.eid.v = eid;
+                    }
+                    if (e.second >= lo && e.second < hi) {
+                        auto &entry = buffer[cursor[e.second - lo]++ - index[lo]];
+                        entry.v = e.first;
+                        entry.eid.v = eid;
+                    }
+                    ++eid;
+                }
+                remaining -= stream_edges.size();
+                if (remaining < chunk_size) {
+                    stream_edges.resize(remaining);
+                }
+            }
+            for (vid_t v = lo; v < hi; ++v)
+                CHECK_EQ(cursor[v - lo], index[v + 1]) << "degree file does not match the edge list";
+            fout.write((char *)buffer.data(), buffer.size() * sizeof(disk_adj_t));
+        }
+        fout.close();
+        LOG(INFO) << "disk adjacency built in " << num_passes << " pass(es)";
+    }
+
+    cache.open(filename, kBlockSize, budget);
+    LOG(INFO) << "disk adjacency: " << entry_offset(num_vertices) / 1024.0 / 1024
+              << " MB on disk, " << cache.capacity() / 1024.0 / 1024 << " MB cached";
+}
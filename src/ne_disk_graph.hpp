@@ -0,0 +1,89 @@
+#ifndef NE_DISK_GRAPH_HPP
+#define NE_DISK_GRAPH_HPP
+
+#include <list>
+#include <unordered_map>
+
+#include "ne_graph.hpp"
+
+/* One adjacency entry of the disk-resident CSR used by out-of-core NE. */
+struct disk_adj_t {
+    static const vid_t kOutBit = (vid_t)1 << 31;
+
+    vid_t v;        // neighbor id, kOutBit is set when the owner is the edge source
+    uint40_t eid;   // edge id in the .binedgelist order
+
+    vid_t vid() const { return v & ~kOutBit; }
+    bool is_out() const { return v & kOutBit; }
+} __attribute__((packed));
+
+/* LRU cache of fixed-size blocks of a read-only file. */
+class block_cache_t
+{
+  private:
+    int fd;
+    size_t file_size;
+    size_t block_size;
+    size_t num_slots;
+    std::vector<char> pool;
+    std::vector<size_t> free_slots;
+    std::list<size_t> lru; // most recently used block at the front
+    std::unordered_map<size_t, std::pair<std::list<size_t>::iterator, size_t>> slot_of;
+
+    const char *get_block(size_t block);
+
+  public:
+    size_t hits = 0, misses = 0, prefetches = 0;
+
+    block_cache_t() : fd(-1), file_size(0), block_size(0), num_slots(0) {}
+    ~block_cache_t();
+
+    void open(const std::string &filename, size_t block_size, size_t budget);
+    void read(size_t offset, size_t len, char *out);
+    void prefetch(size_t offset, size_t len);
+    size_t capacity() const { return num_slots * block_size; }
+};
+
+/* Header of the adjacency file, which is only reused for the same edge list. */
+struct disk_adj_header_t {
+    uint64_t magic, num_vertices, num_edges, edgelist_size, edgelist_mtime;
+};
+
+/* Read-only CSR of both edge directions stored in a file, only the offsets
+ * are kept in memory and the adjacency is served through a block cache. */
+class disk_graph_t
+{
+  private:
+    vid_t num_vertices;
+    std::vector<eid_t> index;
+    block_cache_t cache;
+
+    size_t entry_offset(vid_t vid) const { return sizeof(disk_adj_header_t) + index[vid] * sizeof(disk_adj_t); }
+
+  public:
+    static const size_t kBlockSize = (size_t)1 << 16;
+
+    disk_graph_t() : num_vertices(0) {}
+
+    /// Writes the adjacency file (unless it exists for this edge list) in as many passes
+    /// over the edge list as needed to stay within `budget' bytes, then opens it.
+    void build(const std::string &basefilename, vid_t num_vertices, eid_t num_edges,
+               const std::vector<vid_t> &degrees, size_t budget);
+
+    vid_t degree(vid_t vid) const { return index[vid + 1] - index[vid]; }
+
+    void neighbors(vid_t vid, std::vector<disk_adj_t> &out)
+    {
+        out.resize(degree(vid));
+        cache.read(entry_offset(vid), out.size() * sizeof(disk_adj_t), (char *)out.data());
+    }
+
+    void prefetch(vid_t vid)
+    {
+        cache.prefetch(entry_offset(vid), degree(vid) * sizeof(disk_adj_t));
+    }
+
+    const block_cache_t &get_cache() const { return cache; }
+};
+
+#endif
@@ -0,0 +1,233 @@
+#include "ne_ooc_partitioner.hpp"
+#include "conversions.hpp"
+
+DECLARE_int32(ne_cache_mb);
+
+NeOocPartitioner::NeOocPartitioner(std::string basefilename, bool need_k_split)
+    : basefilename(basefilename), rd(), gen(rd())
+    , need_k_split(need_k_split)
+{
+    if (need_k_split || FLAGS_write == "none") {
+        writer = std::make_unique<EdgepartWriterBase<vid_t, bid_t>>(basefilename);
+    } else {
+        if (FLAGS_write == "onefile") {
+            writer = std::make_unique<EdgepartWriterOnefile<vid_t, bid_t>>(basefilename);
+        } else if (FLAGS_write == "multifile") {
+            writer = std::make_unique<EdgepartWriterMultifile<vid_t, bid_t>>(basefilename);
+        }
+    }
+    Timer convert_timer;
+    convert_timer.start();
+    Converter *converter = new Converter(basefilename);
+    convert(basefilename, converter);
+    delete converter;
+    convert_timer.stop();
+    LOG(INFO) << "convert time: " << convert_timer.get_time();
+
+    total_time.start();
+    LOG(INFO) << "initializing partitioner";
+
+    std::ifstream fin(binedgelist_name(basefilename),
+                      std::ios::binary | std::ios::ate);
+    auto filesize = fin.tellg();
+    LOG(INFO) << "file size: " << filesize;
+    fin.seekg(0, std::ios::beg);
+
+    fin.read((char *)&num_vertices, sizeof(num_vertices));
+    fin.read((char *)&num_edges, sizeof(num_edges));
+
+    LOG(INFO) << "num_vertices: " << num_vertices
+              << ", num_edges: " << num_edges;
+    CHECK_EQ(sizeof(vid_t) + sizeof(eid_t) + num_edges * sizeof(edge_t), filesize);
+    fin.close();
+
+    num_partitions = FLAGS_p;
+    if (need_k_split) {
+        num_partitions *= FLAGS_k;
+    }
+
+    average_degree = num_edges * 2.0 / num_vertices;
+    assigned_edges = 0;
+    capacity = static_cast<double>(num_edges) * BALANCE_RATIO / num_partitions + 1;
+    occupied.assign(num_partitions, 0);
+    is_cores.assign(num_partitions, dense_bitset(num_vertices));
+    is_boundarys.assign(num_partitions, dense_bitset(num_vertices));
+    is_assigned.resize(num_edges);
+    is_assigned.clear();
+    dis.param(std::uniform_int_distribution<vid_t>::param_type(0, num_vertices - 1));
+    if (need_k_split) {
+        edgelist2bucket.assign(num_edges, kInvalidBid);
+    }
+
+    degrees.resize(num_vertices);
+    std::ifstream degree_file(degree_name(basefilename), std::ios::binary);
+    degree_file.read((char *)&degrees[0], num_vertices * sizeof(vid_t));
+    degree_file.close();
+    rest_degrees = degrees;
+
+    Timer read_timer;
+    read_timer.start();
+    LOG(INFO) << "constructing disk adjacency...";
+    graph.build(basefilename, num_vertices, num_edges, degrees, (size_t)FLAGS_ne_cache_mb * 1024 * 1024);
+    read_timer.stop();
+    LOG(INFO) << "time used for graph input and construction: " << read_timer.get_time();
+}
+
+void NeOocPartitioner::add_boundary(vid_t vid)
+{
+    auto &is_core = is_cores[bucket], &is_boundary = is_boundarys[bucket];
+
+    if (is_boundary.get(vid))
+        return;
+    is_boundary.set_bit_unsync(vid);
+
+    if (!is_core.get(vid)) {
+        min_heap.insert(rest_degrees[vid], vid);
+    }
+
+    graph.neighbors(vid, boundary_buf);
+    for (auto &entry : boundary_buf) {
+        eid_t eid = entry.eid.v;
+        if (is_assigned.get(eid))
+            continue;
+        vid_t u = entry.vid();
+        vid_t from = entry.is_out() ? vid : u, to = entry.is_out() ? u : vid;
+        if (is_core.get(u)) {
+            assign_edge(bucket, from, to, eid);
+            min_heap.decrease_key(vid);
+        } else if (is_boundary.get(u) && occupied[bucket] < capacity) {
+            assign_edge(bucket, from, to, eid);
+            min_heap.decrease_key(vid);
+            min_heap.decrease_key(u);
+        }
+    }
+}
+
+void NeOocPartitioner::occupy_vertex(vid_t vid, vid_t d)
+{
+    CHECK(!is_cores[bucket].get(vid)) << "add " << vid << " to core again";
+    is_cores[bucket].set_bit_unsync(vid);
+
+    if (d == 0)
+        return;
+
+    add_boundary(vid);
+
+    graph.neighbors(vid, occupy_buf);
+    // the unassigned neighbors enter the boundary (and the heap) right below,
+    // ask for their adjacency blocks before walking them one by one
+    for (auto &entry : occupy_buf)
+        if (!is_assigned.get(entry.eid.v) && !is_boundarys[bucket].get(entry.vid()))
+            graph.prefetch(entry.vid());
+    for (auto &entry : occupy_buf)
+        if (!is_assigned.get(entry.eid.v))
+            add_boundary(entry.vid());
+}
+
+bool NeOocPartitioner::get_free_vertex(vid_t &vid)
+{
+    vid = dis(gen);
+    if (need_k_split) {
+        for (vid_t offset = 0; offset < num_vertices; ++offset) {
+            vid = (vid + 1) % num_vertices;
+            if (is_cores[bucket].get(vid) || rest_degrees[vid] == 0)
+                continue;
+            return true;
+        }
+        return false;
+    }
+    vid_t count = 0;
+    while (count < num_vertices &&
+           (rest_degrees[vid] == 0 ||
+            rest_degrees[vid] > 2 * average_degree ||
+            is_cores[bucket].get(vid))) {
+        vid = (vid + ++count) % num_vertices;
+    }
+    return count < num_vertices;
+}
+
+void NeOocPartitioner::assign_remaining()
+{
+    auto &is_boundary = is_boundarys[num_partitions - 1], &is_core = is_cores[num_partitions - 1];
+
+    std::ifstream fin(binedgelist_name(basefilename), std::ios::binary);
+    fin.seekg(sizeof(vid_t) + sizeof(eid_t), std::ios::beg);
+    const eid_t chunk_size = std::min(num_edges, (eid_t)100000);
+    std::vector<edge_t> stream_edges(chunk_size);
+    eid_t remaining = num_edges, eid = 0;
+    while (remaining > 0) {
+        fin.read((char *)&stream_edges[0], sizeof(edge_t) * stream_edges.size());
+        for (auto &e : stream_edges) {
+            if (!is_assigned.get(eid)) {
+                assign_edge(num_partitions - 1, e.first, e.second, eid);
+                is_boundary.set_bit_unsync(e.first);
+                is_boundary.set_bit_unsync(e.second);
+            }
+            ++eid;
+        }
+        remaining -= stream_edges.size();
+        if (remaining < chunk_size) {
+            stream_edges.resize(remaining);
+        }
+    }
+
+    for (vid_t i = 0; i < num_vertices; ++i) {
+        if (is_boundary.get(i)) {
+            is_core.set_bit_unsync(i);
+            for (bid_t b = 0; b < num_partitions - 1; ++b) {
+                if (is_cores[b].get(i)) {
+                    is_core.set_unsync(i, false);
+                    break;
+                }
+            }
+        }
+    }
+}
+
+void NeOocPartitioner::split()
+{
+    LOG(INFO) << "partition `" << basefilename << "'";
+    LOG(INFO) << "number of partitions: " << (uint32_t)num_partitions;
+
+    min_heap.reserve(num_vertices);
+
+    LOG(INFO) << "partitioning...";
+    partition_time.start();
+    for (bucket = 0; bucket < num_partitions - 1; ++bucket) {
+        std::cerr << (uint32_t)bucket << ", ";
+        while (occupied[bucket] < capacity) {
+            vid_t d, vid;
+            if (!min_heap.get_min(d, vid)) {
+                if (!get_free_vertex(vid)) {
+                    DLOG(INFO) << "partition " << bucket
+                               << " stop: no free vertices";
+                    break;
+                }
+                d = rest_degrees[vid];
+            } else {
+                min_heap.remove(vid);
+            }
+
+            occupy_vertex(vid, d);
+        }
+        min_heap.clear();
+    }
+    bucket = num_partitions - 1;
+    std::cerr << (uint32_t)bucket << std::endl;
+    assign_remaining();
+
+    partition_time.stop();
+    total_time.stop();
+
+    auto &cache = graph.get_cache();
+    LOG(INFO) << "block cache hits: " << cache.hits << ", misses: " << cache.misses
+              << ", prefetches: " << cache.prefetches;
+    if (!need_k_split) {
+        LOG(INFO) << "partitioning time: " << partition_time.get_time();
+        LOG(INFO) << "total time: " << total_time.get_time();
+    }
+
+    CHECK_EQ(assigned_edges, num_edges);
+
+    calculate_stats();
+}
@@ -0,0 +1,66 @@
+#ifndef NE_OOC_PARTITIONER_HPP
+#define NE_OOC_PARTITIONER_HPP
+
+#include <memory>
+#include <random>
+
+#include "min_heap.hpp"
+#include "dense_bitset.hpp"
+#include "part_writer.hpp"
+#include "partitioner.hpp"
+#include "ne_disk_graph.hpp"
+
+/* Out-of-core Neighbor Expansion (NE)
+ * The adjacency lives on disk (see disk_graph_t), only the frontier heap,
+ * the core/boundary bitsets, the remaining degrees and one bit per edge
+ * are kept in memory. */
+class NeOocPartitioner : public EdgeListEPartitioner
+{
+  private:
+    const double BALANCE_RATIO = 1.00;
+
+    std::string basefilename;
+
+    eid_t assigned_edges;
+    bid_t bucket;
+    double average_degree;
+    eid_t capacity;
+
+    disk_graph_t graph;
+    dense_bitset is_assigned;
+    std::vector<vid_t> rest_degrees;
+    MinHeap<vid_t, vid_t> min_heap;
+    std::vector<dense_bitset> is_cores;
+    std::vector<disk_adj_t> occupy_buf, boundary_buf;
+
+    std::random_device rd;
+    std::mt19937 gen;
+    std::uniform_int_distribution<vid_t> dis;
+
+    bool need_k_split;
+    std::unique_ptr<EdgepartWriterBase<vid_t, bid_t>> writer = nullptr;
+
+    void assign_edge(bid_t bucket, vid_t from, vid_t to, eid_t edge_id)
+    {
+        writer->save_edge(from, to, bucket);
+        if (need_k_split) {
+            edgelist2bucket[edge_id] = bucket;
+        }
+        is_assigned.set_bit_unsync(edge_id);
+        ++assigned_edges;
+        ++occupied[bucket];
+        --rest_degrees[from];
+        --rest_degrees[to];
+    }
+
+    void add_boundary(vid_t vid);
+    void occupy_vertex(vid_t vid, vid_t d);
+    bool get_free_vertex(vid_t &vid);
+    void assign_remaining();
+
+  public:
+    NeOocPartitioner(std::string basefilename, bool need_k_split);
+    void split();
+};
+
+#endif
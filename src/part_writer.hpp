@@ -1,6 +1,8 @@
 #ifndef PART_WRITER_HPP
 #define PART_WRITER_HPP
 
+#include <mutex>
+
 #include "util.hpp"
 
 template <typename vertex_type, typename proc_type>
@@ -8,6 +10,7 @@ class EdgepartWriterBase
 {
 protected:
     std::vector<std::ofstream> fout_;
+    std::vector<std::mutex> fout_mutex_; // guards fout_ in save_block
     size_t size_pre_line_;
 
     using new_proc_type = std::conditional_t<std::is_same_v<proc_type, uint8_t>, uint16_t, proc_type>;
@@ -24,6 +27,71 @@ public:
     {
         return;
     }
+
+    size_t num_files() const { return fout_.size(); }
+
+    /// output file of the edges of proc
+    virtual size_t file_of(proc_type proc) const { return 0; }
+
+    /// appends the line save_edge would write
+    virtual void append_edge(std::string &block, vertex_type from, vertex_type to, proc_type proc) {}
+
+    /// writes lines collected by append_edge; may be called from several threads
+    void save_block(size_t file, const std::string &block)
+    {
+        std::lock_guard<std::mutex> lock(fout_mutex_[file]);
+        fout_[file].write(block.data(), block.size());
+    }
+
+    /// pushes the buffered lines to the files
+    void flush()
+    {
+        for (auto &fout : fout_) {
+            fout.flush();
+        }
+    }
+};
+
+/* Per-thread buffers in front of a shared writer, one per output file.
+ * Full buffers are handed over with one locked write instead of a virtual
+ * call per edge. */
+template <typename vertex_type, typename proc_type>
+class EdgepartBlockWriter
+{
+private:
+    static const size_t kBlockBytes = 1 << 20;
+
+    EdgepartWriterBase<vertex_type, proc_type> &writer_;
+    std::vector<std::string> blocks_;
+
+public:
+    EdgepartBlockWriter(EdgepartWriterBase<vertex_type, proc_type> &writer)
+        : writer_(writer), blocks_(writer.num_files()) {}
+
+    ~EdgepartBlockWriter() { flush(); }
+
+    void save_edge(vertex_type from, vertex_type to, proc_type proc)
+    {
+        if (blocks_.empty()) {
+            return;
+        }
+        size_t file = writer_.file_of(proc);
+        writer_.append_edge(blocks_[file], from, to, proc);
+        if (blocks_[file].size() >= kBlockBytes) {
+            writer_.save_block(file, blocks_[file]);
+            blocks_[file].clear();
+        }
+    }
+
+    void flush()
+    {
+        for (size_t file = 0; file < blocks_.size(); ++file) {
+            if (!blocks_[file].empty()) {
+                writer_.save_block(file, blocks_[file]);
+                blocks_[file].clear();
+            }
+        }
+    }
 };
 
 
@@ -34,21 +102,32 @@ class EdgepartWriterOnefile : public EdgepartWriterBase<vertex_type, proc_type>
     using typename EdgepartWriterBase<vertex_type, proc_type>::new_proc_type;
 
 public:
-    EdgepartWriterOnefile(const std::string &basefilename)
+    EdgepartWriterOnefile(const std::string &basefilename, int level = 0)
         : EdgepartWriterBase<vertex_type, proc_type>(basefilename)
     {
-        std::string filename = edge_partitioned_name(basefilename);
+        std::string filename = edge_partitioned_name(basefilename, level);
         fout_.push_back(std::ofstream(filename, std::ios_base::trunc));
         if (!fout_.back().is_open()) {
             std::cerr << "Error opening file: " << filename << std::endl;
             exit(1);
         }
+        this->fout_mutex_ = std::vector<std::mutex>(fout_.size());
     }
     
     void save_edge(vertex_type from, vertex_type to, proc_type proc) override
     {
         fout_[0] << from << ' ' << to << ' ' << (new_proc_type)proc << std::endl;
     }
+
+    void append_edge(std::string &block, vertex_type from, vertex_type to, proc_type proc) override
+    {
+        block += std::to_string(from);
+        block += ' ';
+        block += std::to_string(to);
+        block += ' ';
+        block += std::to_string((new_proc_type)proc);
+        block += '\n';
+    }
 };
 
 template <typename vertex_type, typename proc_type>
@@ -59,17 +138,20 @@ private:
     using typename EdgepartWriterBase<vertex_type, proc_type>::new_proc_type;
 
 public:
-    EdgepartWriterMultifile(const std::string &basefilename)
+    /// level: FSM output level (see partition_levels), the files are per partition of that level
+    EdgepartWriterMultifile(const std::string &basefilename, int level = 0)
         : EdgepartWriterBase<vertex_type, proc_type>(basefilename)
     {
-        for (bid_t b = 0; b < FLAGS_p; ++b) {
-            std::string filename = edge_partitioned_name(basefilename) + ".part" + std::to_string(b);
+        int num_parts = partition_levels()[level];
+        for (int b = 0; b < num_parts; ++b) {
+            std::string filename = edge_partitioned_name(basefilename, level) + ".part" + std::to_string(b);
             fout_.push_back(std::ofstream(filename, std::ios_base::trunc));
             if (!fout_.back().is_open()) {
                 std::cerr << "Error opening file: " << filename << std::endl;
                 exit(1);
             }
         }
+        this->fout_mutex_ = std::vector<std::mutex>(fout_.size());
     }
 
     ~EdgepartWriterMultifile() {}
@@ -78,6 +160,16 @@ public:
     {
         fout_[(new_proc_type)proc] << from << ' ' << to << std::endl;
     }
+
+    size_t file_of(proc_type proc) const override { return (new_proc_type)proc; }
+
+    void append_edge(std::string &block, vertex_type from, vertex_type to, proc_type proc) override
+    {
+        block += std::to_string(from);
+        block += ' ';
+        block += std::to_string(to);
+        block += '\n';
+    }
 };
 
 
@@ -32,17 +32,29 @@ public:
     std::vector<vid_t> degrees;
     std::vector<bid_t> edgelist2bucket;
 
-    void calculate_stats(bool called_by_fsm = false)
+    double replication_factor() const
     {
-        LOG(INFO) << std::string(25, '#') << " Calculating Statistics " << std::string(25, '#') << '\n';
-        if (called_by_fsm) {
-            num_partitions = FLAGS_p;
+        vid_t all_part_vertice_cnt = 0;
+        for (bid_t b = 0; b < num_partitions; ++b) {
+            all_part_vertice_cnt += is_boundarys[b].popcount();
         }
+        return (double)all_part_vertice_cnt / num_vertices;
+    }
 
+    void calculate_stats(bool called_by_fsm = false)
+    {
         std::vector<vid_t> num_bucket_vertices(num_partitions, 0);
         for (bid_t b = 0; b < num_partitions; ++b) {
             num_bucket_vertices[b] = is_boundarys[b].popcount();
         }
+        print_stats(num_bucket_vertices);
+    }
+
+    /// stats of the partitions, given the number of vertices of each
+    void print_stats(const std::vector<vid_t> &num_bucket_vertices)
+    {
+        LOG(INFO) << std::string(25, '#') << " Calculating Statistics " << std::string(25, '#') << '\n';
+
         vid_t max_part_vertice_cnt = *std::max_element(num_bucket_vertices.begin(), num_bucket_vertices.end());
         vid_t all_part_vertice_cnt = accumulate(num_bucket_vertices.begin(), num_bucket_vertices.end(), (vid_t)0);
         eid_t max_part_edge_cnt = *std::max_element(occupied.begin(), occupied.end());
@@ -101,6 +113,12 @@ public:
     std::vector<vid_t> degrees;
     std::vector<bid_t> vertex2bucket;
 
+    double edge_cut_ratio() const
+    {
+        eid_t total_cut_edges = accumulate(occupied.begin(), occupied.end(), (eid_t)0) - num_edges;
+        return (double)total_cut_edges / num_edges;
+    }
+
     void calculate_stats(bool called_by_fsm = false)
     {
         LOG(INFO) << std::string(25, '#') << " Calculating Statistics " << std::string(25, '#') << '\n';
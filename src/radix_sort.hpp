@@ -0,0 +1,58 @@
+#ifndef RADIX_SORT_HPP
+#define RADIX_SORT_HPP
+
+#include <omp.h>
+#include <vector>
+#include <algorithm>
+
+#include "common.hpp"
+
+/// Stable LSD radix sort of items by a 32-bit key, 8 bits per pass and only
+/// as many passes as max_key needs. Every pass is a per-thread histogram,
+/// a prefix sum over (digit, thread) and a scatter into a second buffer.
+template <typename T, typename KeyOf>
+void parallel_radix_sort(std::vector<T> &items, KeyOf key_of, uint32_t max_key, int num_threads)
+{
+    const int kBits = 8;
+    const size_t kBuckets = size_t(1) << kBits;
+    const size_t n = items.size();
+    if (max_key == 0) {
+        return;
+    }
+
+    std::vector<T> tmp(n);
+    std::vector<size_t> offsets(num_threads * kBuckets);
+    for (int shift = 0; shift < 32 && (max_key >> shift) > 0; shift += kBits) {
+        std::fill(offsets.begin(), offsets.end(), 0);
+
+        #pragma omp parallel num_threads(num_threads)
+        {
+            const int t = omp_get_thread_num(), threads = omp_get_num_threads();
+            const size_t begin = n * t / threads, end = n * (t + 1) / threads;
+            size_t *count = &offsets[t * kBuckets];
+            for (size_t i = begin; i < end; ++i) {
+                ++count[(key_of(items[i]) >> shift) & (kBuckets - 1)];
+            }
+
+            #pragma omp barrier
+            #pragma omp single
+            {
+                size_t sum = 0;
+                for (size_t d = 0; d < kBuckets; ++d) {
+                    for (int tt = 0; tt < threads; ++tt) {
+                        size_t c = offsets[tt * kBuckets + d];
+                        offsets[tt * kBuckets + d] = sum;
+                        sum += c;
+                    }
+                }
+            }
+
+            for (size_t i = begin; i < end; ++i) {
+                tmp[count[(key_of(items[i]) >> shift) & (kBuckets - 1)]++] = items[i];
+            }
+        }
+        items.swap(tmp);
+    }
+}
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef REPLICA_COUNTS_HPP
+#define REPLICA_COUNTS_HPP
+
+#include <unordered_map>
+
+#include "common.hpp"
+
+/* Number of edges of each (vertex, partition) pair, so that taking an edge
+ * out tells whether it held the last replica. A byte per pair; a pair that
+ * reaches 255 edges, only possible for a vertex of degree 255 or more,
+ * keeps the rest of its count in a map, so the count stays exact. */
+class replica_counts_t
+{
+  private:
+    bid_t num_partitions = 0;
+    std::vector<uint8_t> counts;
+    std::unordered_map<size_t, uint32_t> overflow; // edges beyond 255 of the saturated pairs
+
+  public:
+    void init(vid_t num_vertices, bid_t num_partitions)
+    {
+        this->num_partitions = num_partitions;
+        counts.assign((size_t)num_vertices * num_partitions, 0);
+        overflow.clear();
+    }
+
+    bool empty() const { return counts.empty(); }
+
+    bool has(vid_t v, bid_t b) const { return counts[(size_t)v * num_partitions + b] > 0; }
+
+    /// @return true if v just became a replica in b
+    bool add(vid_t v, bid_t b)
+    {
+        size_t pair = (size_t)v * num_partitions + b;
+        uint8_t &c = counts[pair];
+        if (c == 255) {
+            ++overflow[pair];
+            return false;
+        }
+        return ++c == 1;
+    }
+
+    /// @return true if v no longer is a replica in b
+    bool remove(vid_t v, bid_t b)
+    {
+        size_t pair = (size_t)v * num_partitions + b;
+        uint8_t &c = counts[pair];
+        if (c == 255) {
+            auto it = overflow.find(pair);
+            if (it != overflow.end()) {
+                if (--it->second == 0) {
+                    overflow.erase(it);
+                }
+                return false;
+            }
+        }
+        return --c == 0;
+    }
+};
+
+#endif
@@ -0,0 +1,327 @@
+#ifndef REPLICA_OVERLAP_HPP
+#define REPLICA_OVERLAP_HPP
+
+#include <algorithm>
+#include <iterator>
+
+#include <omp.h>
+
+#include "common.hpp"
+#include "dense_bitset.hpp"
+
+/* Replica overlaps of a set of buckets and of groups of them, so that the
+ * size of any group union comes without touching the bitsets again.
+ *
+ * build() reads the bucket bitsets once into the buckets of every vertex
+ * (a CSR over the vertex ids) and counts, in a parallel pass over it, the
+ * pairwise matrix pair(a, b) = |a ∩ b|. For a group G, row(G)[b] = |G ∩ b|
+ * follows from the matrix when a bucket joins G, corrected by the vertices
+ * it already shared with G (the higher-order terms). For those, the
+ * vertices of each bucket are kept as a compact index next to the CSR:
+ * the gaps between them in 7-bit groups, about a byte per replica.
+ *
+ * Once every bucket has a group, set_groups() also counts
+ * unique(a, b) = |{v in a ∩ b : a is the only bucket of its group with v}|,
+ * which prices a swap of two buckets between groups in O(1). A swap only
+ * changes the terms of the vertices of the two buckets. */
+class ReplicaOverlap
+{
+  private:
+    size_t num_buckets = 0, num_groups = 0;
+    std::vector<vid_t> pairs;   // num_buckets x num_buckets
+    std::vector<eid_t> offsets; // vertex -> its buckets (CSR)
+    std::vector<bid_t> buckets_of;
+    std::vector<size_t> index_offsets; // bucket -> its vertices, gap-encoded
+    std::vector<uint8_t> vertex_index;
+
+    std::vector<bid_t> group_of;    // bucket -> group, kInvalidBid if none yet
+    std::vector<vid_t> group_rows;  // num_groups x num_buckets, |G ∩ b|
+    std::vector<vid_t> group_sizes; // |G|
+    std::vector<vid_t> uniques;     // num_buckets x num_buckets, after set_groups()
+
+    static size_t gap_bytes(vid_t gap)
+    {
+        size_t bytes = 1;
+        while (gap >>= 7) {
+            ++bytes;
+        }
+        return bytes;
+    }
+
+    // two passes over the CSR: the index size of every bucket, then the gaps
+    void build_vertex_index()
+    {
+        const vid_t num_vertices = offsets.size() - 1;
+        std::vector<vid_t> last(num_buckets, 0);
+        index_offsets.assign(num_buckets + 1, 0);
+        for (vid_t v = 0; v < num_vertices; ++v) {
+            for (eid_t i = offsets[v]; i < offsets[v + 1]; ++i) {
+                index_offsets[buckets_of[i] + 1] += gap_bytes(v - last[buckets_of[i]]);
+                last[buckets_of[i]] = v;
+            }
+        }
+        for (size_t b = 0; b < num_buckets; ++b) {
+            index_offsets[b + 1] += index_offsets[b];
+        }
+        vertex_index.resize(index_offsets[num_buckets]);
+        std::vector<size_t> fill(index_offsets.begin(), index_offsets.end() - 1);
+        std::fill(last.begin(), last.end(), 0);
+        for (vid_t v = 0; v < num_vertices; ++v) {
+            for (eid_t i = offsets[v]; i < offsets[v + 1]; ++i) {
+                bid_t b = buckets_of[i];
+                vid_t gap = v - last[b];
+                for (; gap >= 0x80; gap >>= 7) {
+                    vertex_index[fill[b]++] = (gap & 0x7f) | 0x80;
+                }
+                vertex_index[fill[b]++] = gap;
+                last[b] = v;
+            }
+        }
+    }
+
+    // the vertices of bucket b in increasing order, decoded from the index
+    std::vector<vid_t> vertices(bid_t b) const
+    {
+        std::vector<vid_t> vertices;
+        vid_t v = 0;
+        for (size_t i = index_offsets[b]; i < index_offsets[b + 1];) {
+            vid_t gap = 0;
+            for (int shift = 0;; shift += 7) {
+                uint8_t byte = vertex_index[i++];
+                gap |= (vid_t)(byte & 0x7f) << shift;
+                if (!(byte & 0x80)) {
+                    break;
+                }
+            }
+            v += gap;
+            vertices.push_back(v);
+        }
+        return vertices;
+    }
+
+    // adds (sign 1) or takes out (sign -1) the share of v in the group sizes,
+    // group rows and uniques
+    void vertex_terms(vid_t v, int sign, vid_t *sizes, vid_t *rows, vid_t *uniq) const
+    {
+        for (eid_t i = offsets[v]; i < offsets[v + 1]; ++i) {
+            bid_t g = group_of[buckets_of[i]];
+            if (g == kInvalidBid) {
+                continue;
+            }
+            bool first = true;
+            bid_t cover = 0;
+            for (eid_t j = offsets[v]; j < offsets[v + 1]; ++j) {
+                if (group_of[buckets_of[j]] == g) {
+                    first &= j >= i;
+                    ++cover;
+                }
+            }
+            if (first) {
+                sizes[g] += sign;
+                for (eid_t j = offsets[v]; j < offsets[v + 1]; ++j) {
+                    rows[g * num_buckets + buckets_of[j]] += sign;
+                }
+            }
+            if (cover == 1) {
+                for (eid_t j = offsets[v]; j < offsets[v + 1]; ++j) {
+                    uniq[buckets_of[i] * num_buckets + buckets_of[j]] += sign;
+                }
+            }
+        }
+    }
+
+  public:
+    /// builds the CSR from the bitsets in parallel over blocks of vertex words:
+    /// count, prefix sum, fill
+    void build(const std::vector<const dense_bitset *> &buckets, size_t num_groups, int threads)
+    {
+        const vid_t num_vertices = buckets.empty() ? 0 : buckets[0]->size();
+        const size_t num_words = buckets.empty() ? 0 : buckets[0]->num_words();
+        const size_t block_words = 64; // 4096 vertices
+        const size_t num_blocks = (num_words + block_words - 1) / block_words;
+        std::vector<eid_t> vertex_offsets(num_vertices + 1, 0);
+        #pragma omp parallel for num_threads(threads) schedule(dynamic, 16)
+        for (size_t block = 0; block < num_blocks; ++block) {
+            const size_t first = block * block_words, last = std::min(num_words, first + block_words);
+            for (size_t b = 0; b < buckets.size(); ++b) {
+                const size_t *words = buckets[b]->words();
+                for (size_t w = first; w < last; ++w) {
+                    for (size_t word = words[w]; word; word &= word - 1) {
+                        ++vertex_offsets[w * 64 + __builtin_ctzl(word) + 1];
+                    }
+                }
+            }
+        }
+        for (vid_t v = 0; v < num_vertices; ++v) {
+            vertex_offsets[v + 1] += vertex_offsets[v];
+        }
+        std::vector<bid_t> vertex_buckets(vertex_offsets[num_vertices]);
+        #pragma omp parallel for num_threads(threads) schedule(dynamic, 16)
+        for (size_t block = 0; block < num_blocks; ++block) {
+            const size_t first = block * block_words, last = std::min(num_words, first + block_words);
+            eid_t fill[block_words * 64];
+            for (size_t v = first * 64; v < std::min<size_t>(last * 64, num_vertices); ++v) {
+                fill[v - first * 64] = vertex_offsets[v];
+            }
+            for (size_t b = 0; b < buckets.size(); ++b) {
+                const size_t *words = buckets[b]->words();
+                for (size_t w = first; w < last; ++w) {
+                    for (size_t word = words[w]; word; word &= word - 1) {
+                        vertex_buckets[fill[(w - first) * 64 + __builtin_ctzl(word)]++] = b;
+                    }
+                }
+            }
+        }
+        build(std::move(vertex_offsets), std::move(vertex_buckets), buckets.size(), num_groups, threads);
+    }
+
+    /// builds from the buckets of every vertex (CSR over the vertex ids),
+    /// which are kept until release_lists()
+    void build(std::vector<eid_t> &&vertex_offsets, std::vector<bid_t> &&vertex_buckets, size_t num_buckets,
+               size_t num_groups, int threads)
+    {
+        offsets = std::move(vertex_offsets);
+        buckets_of = std::move(vertex_buckets);
+        this->num_buckets = num_buckets;
+        this->num_groups = num_groups;
+        const vid_t num_vertices = offsets.size() - 1;
+
+        pairs.assign(num_buckets * num_buckets, 0);
+        #pragma omp parallel num_threads(threads)
+        {
+            std::vector<vid_t> local_pairs(num_buckets * num_buckets, 0);
+            #pragma omp for schedule(dynamic, 4096)
+            for (vid_t v = 0; v < num_vertices; ++v) {
+                for (eid_t i = offsets[v]; i < offsets[v + 1]; ++i) {
+                    vid_t *row = &local_pairs[buckets_of[i] * num_buckets];
+                    for (eid_t j = offsets[v]; j < offsets[v + 1]; ++j) {
+                        ++row[buckets_of[j]];
+                    }
+                }
+            }
+            #pragma omp critical
+            for (size_t i = 0; i < pairs.size(); ++i) {
+                pairs[i] += local_pairs[i];
+            }
+        }
+        build_vertex_index();
+
+        group_of.assign(num_buckets, kInvalidBid);
+        group_rows.assign(num_groups * num_buckets, 0);
+        group_sizes.assign(num_groups, 0);
+    }
+
+    vid_t pair(bid_t a, bid_t b) const { return pairs[a * num_buckets + b]; }
+    vid_t bucket_size(bid_t b) const { return pair(b, b); }
+
+    vid_t group_size(bid_t g) const { return group_sizes[g]; }
+    /// |G ∩ b|
+    vid_t group_overlap(bid_t g, bid_t b) const { return group_rows[g * num_buckets + b]; }
+    /// |G ∪ b|
+    vid_t union_size(bid_t g, bid_t b) const { return group_size(g) + bucket_size(b) - group_overlap(g, b); }
+
+    void add_to_group(bid_t g, bid_t a)
+    {
+        vid_t *row = &group_rows[g * num_buckets];
+        group_sizes[g] += bucket_size(a) - row[a];
+        // |(G ∪ a) ∩ b| = |G ∩ b| + |a ∩ b| - |G ∩ a ∩ b|
+        for (size_t b = 0; b < num_buckets; ++b) {
+            row[b] += pair(a, b);
+        }
+        for (vid_t v : vertices(a)) {
+            bool in_group = false;
+            for (eid_t i = offsets[v]; i < offsets[v + 1] && !in_group; ++i) {
+                in_group = group_of[buckets_of[i]] == g;
+            }
+            if (in_group) {
+                for (eid_t i = offsets[v]; i < offsets[v + 1]; ++i) {
+                    --row[buckets_of[i]];
+                }
+            }
+        }
+        group_of[a] = g;
+    }
+
+    /// regroups every bucket and recounts the group terms and the uniques
+    void set_groups(const std::vector<bid_t> &groups, int threads)
+    {
+        CHECK_EQ(groups.size(), num_buckets);
+        group_of = groups;
+        const vid_t num_vertices = offsets.size() - 1;
+        group_rows.assign(num_groups * num_buckets, 0);
+        group_sizes.assign(num_groups, 0);
+        uniques.assign(num_buckets * num_buckets, 0);
+        #pragma omp parallel num_threads(threads)
+        {
+            std::vector<vid_t> local_sizes(num_groups, 0), local_rows(group_rows.size(), 0),
+                local_uniques(uniques.size(), 0);
+            #pragma omp for schedule(dynamic, 4096)
+            for (vid_t v = 0; v < num_vertices; ++v) {
+                vertex_terms(v, 1, local_sizes.data(), local_rows.data(), local_uniques.data());
+            }
+            #pragma omp critical
+            {
+                for (size_t i = 0; i < num_groups; ++i) {
+                    group_sizes[i] += local_sizes[i];
+                }
+                for (size_t i = 0; i < group_rows.size(); ++i) {
+                    group_rows[i] += local_rows[i];
+                }
+                for (size_t i = 0; i < uniques.size(); ++i) {
+                    uniques[i] += local_uniques[i];
+                }
+            }
+        }
+    }
+
+    /// hands the bucket lists of the vertices back, the overlaps are unusable afterwards
+    void release_lists(std::vector<eid_t> &vertex_offsets, std::vector<bid_t> &vertex_buckets)
+    {
+        vertex_offsets = std::move(offsets);
+        vertex_buckets = std::move(buckets_of);
+        index_offsets.clear();
+        vertex_index = std::vector<uint8_t>();
+    }
+
+    bid_t group_of_bucket(bid_t b) const { return group_of[b]; }
+
+    /// calls handler(v, b) for every bucket b of every vertex v
+    template <typename Handler>
+    void for_each_replica(Handler handler) const
+    {
+        const vid_t num_vertices = offsets.size() - 1;
+        for (vid_t v = 0; v < num_vertices; ++v) {
+            for (eid_t i = offsets[v]; i < offsets[v + 1]; ++i) {
+                handler(v, buckets_of[i]);
+            }
+        }
+    }
+
+    /// decrease of the total group size if a and b, of different groups,
+    /// trade places; needs set_groups()
+    int64_t swap_gain(bid_t a, bid_t b) const
+    {
+        bid_t g = group_of[a], h = group_of[b];
+        // |G - a + b| - |G| = -unique(a, a) + |b| - |G ∩ b| + unique(a, b)
+        int64_t delta = (int64_t)bucket_size(b) - group_overlap(g, b) - uniques[a * num_buckets + a] +
+                        uniques[a * num_buckets + b];
+        delta += (int64_t)bucket_size(a) - group_overlap(h, a) - uniques[b * num_buckets + b] +
+                 uniques[b * num_buckets + a];
+        return -delta;
+    }
+
+    void swap_buckets(bid_t a, bid_t b)
+    {
+        std::vector<vid_t> in_a = vertices(a), in_b = vertices(b), touched;
+        std::set_union(in_a.begin(), in_a.end(), in_b.begin(), in_b.end(), std::back_inserter(touched));
+        for (vid_t v : touched) {
+            vertex_terms(v, -1, group_sizes.data(), group_rows.data(), uniques.data());
+        }
+        std::swap(group_of[a], group_of[b]);
+        for (vid_t v : touched) {
+            vertex_terms(v, 1, group_sizes.data(), group_rows.data(), uniques.data());
+        }
+    }
+};
+
+#endif
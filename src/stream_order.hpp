@@ -0,0 +1,187 @@
+#ifndef STREAM_ORDER_HPP
+#define STREAM_ORDER_HPP
+
+#include <omp.h>
+#include <numeric>
+#include <algorithm>
+
+#include "common.hpp"
+#include "graph.hpp"
+#include "radix_sort.hpp"
+#include "util.hpp"
+
+// vertices per chunk of the chunk order, small enough to shuffle well and
+// large enough to keep the id locality of the input within a chunk
+const vid_t kOrderChunkVertices = 4096;
+
+// splitmix64, a random key per item that does not depend on the thread count
+inline uint32_t order_hash(uint64_t seed, uint64_t x)
+{
+    uint64_t z = seed + (x + 1) * 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return (uint32_t)((z ^ (z >> 31)) >> 32);
+}
+
+// permutation of 0..n-1 by a key per item; ties keep the id order
+template <typename KeyOf>
+std::vector<vid_t> keyed_permutation(vid_t n, KeyOf key_of, int threads)
+{
+    std::vector<std::pair<uint32_t, vid_t>> keyed(n);
+    uint32_t max_key = 0;
+    #pragma omp parallel for num_threads(threads) reduction(max : max_key)
+    for (vid_t i = 0; i < n; ++i) {
+        keyed[i] = {key_of(i), i};
+        max_key = std::max(max_key, keyed[i].first);
+    }
+    parallel_radix_sort(keyed, [](const std::pair<uint32_t, vid_t> &k) { return k.first; }, max_key, threads);
+
+    std::vector<vid_t> order(n);
+    #pragma omp parallel for num_threads(threads)
+    for (vid_t i = 0; i < n; ++i) {
+        order[i] = keyed[i].second;
+    }
+    return order;
+}
+
+// Level-synchronous BFS, restarted from the smallest unvisited id. Each
+// level is expanded in parallel over static slices of the frontier, and
+// the next frontier is the per-thread lists in thread order, so with one
+// thread this is the plain sequential BFS.
+template <typename TAdj>
+std::vector<vid_t> bfs_order(Graph<TAdj> &graph, int threads)
+{
+    const vid_t n = graph.num_vertices;
+    std::vector<vid_t> order;
+    order.reserve(n);
+    std::vector<uint8_t> visited(n, 0);
+    std::vector<std::vector<vid_t>> next(threads);
+    for (vid_t root = 0; root < n; ++root) {
+        if (visited[root]) {
+            continue;
+        }
+        visited[root] = 1;
+        size_t begin = order.size();
+        order.push_back(root);
+        while (begin < order.size()) {
+            const size_t end = order.size();
+            #pragma omp parallel num_threads(threads) if (end - begin > 1024)
+            {
+                std::vector<vid_t> &local = next[omp_get_thread_num()];
+                #pragma omp for schedule(static)
+                for (size_t i = begin; i < end; ++i) {
+                    auto &neighbors = graph[order[i]];
+                    for (vid_t j = 0; j < neighbors.size(); ++j) {
+                        vid_t u = neighbors[j].vid;
+                        if (!visited[u] && __sync_bool_compare_and_swap(&visited[u], 0, 1)) {
+                            local.push_back(u);
+                        }
+                    }
+                }
+            }
+            for (auto &local : next) {
+                order.insert(order.end(), local.begin(), local.end());
+                local.clear();
+            }
+            begin = end;
+        }
+    }
+    return order;
+}
+
+// preorder DFS, restarted from the smallest unvisited id
+template <typename TAdj>
+std::vector<vid_t> dfs_order(Graph<TAdj> &graph)
+{
+    const vid_t n = graph.num_vertices;
+    std::vector<vid_t> order;
+    order.reserve(n);
+    std::vector<uint8_t> visited(n, 0);
+    std::vector<std::pair<vid_t, vid_t>> stack; // (vertex, next neighbor)
+    for (vid_t root = 0; root < n; ++root) {
+        if (visited[root]) {
+            continue;
+        }
+        visited[root] = 1;
+        order.push_back(root);
+        stack.push_back({root, 0});
+        while (!stack.empty()) {
+            auto &[v, next] = stack.back();
+            auto &neighbors = graph[v];
+            while (next < neighbors.size() && visited[neighbors[next].vid]) {
+                ++next;
+            }
+            if (next == neighbors.size()) {
+                stack.pop_back();
+                continue;
+            }
+            vid_t u = neighbors[next++].vid;
+            visited[u] = 1;
+            order.push_back(u);
+            stack.push_back({u, 0});
+        }
+    }
+    return order;
+}
+
+/// @return the order in which a vertex-streaming partitioner visits the
+/// vertices of graph, as a permutation of the vertex ids:
+///   id      0, 1, ..., n-1
+///   random  uniform shuffle by seed
+///   bfs     breadth-first from the smallest unvisited id
+///   dfs     depth-first (preorder) from the smallest unvisited id
+///   degree  degree descending, ties by id
+///   chunk   id order within chunks of kOrderChunkVertices, chunks shuffled by seed
+template <typename TAdj>
+std::vector<vid_t> stream_order(Graph<TAdj> &graph, const std::string &order_name, uint64_t seed, int threads)
+{
+    const vid_t n = graph.num_vertices;
+    Timer order_timer;
+    order_timer.start();
+    std::vector<vid_t> order;
+    if (order_name == "id") {
+        order.resize(n);
+        #pragma omp parallel for num_threads(threads)
+        for (vid_t i = 0; i < n; ++i) {
+            order[i] = i;
+        }
+    } else if (order_name == "random") {
+        order = keyed_permutation(n, [&](vid_t v) { return order_hash(seed, v); }, threads);
+    } else if (order_name == "bfs") {
+        order = bfs_order(graph, threads);
+    } else if (order_name == "dfs") {
+        order = dfs_order(graph);
+    } else if (order_name == "degree") {
+        vid_t max_degree = 0;
+        #pragma omp parallel for num_threads(threads) reduction(max : max_degree)
+        for (vid_t v = 0; v < n; ++v) {
+            max_degree = std::max(max_degree, graph[v].size());
+        }
+        order = keyed_permutation(n, [&](vid_t v) { return max_degree - graph[v].size(); }, threads);
+    } else if (order_name == "chunk") {
+        const vid_t num_chunks = (n + kOrderChunkVertices - 1) / kOrderChunkVertices;
+        std::vector<vid_t> chunks =
+            keyed_permutation(num_chunks, [&](vid_t c) { return order_hash(seed, c); }, threads);
+        // only the last chunk may be short, so a chunk starts where the
+        // chunks before it in the shuffled order end
+        std::vector<vid_t> chunk_begin(num_chunks + 1, 0);
+        for (vid_t i = 0; i < num_chunks; ++i) {
+            vid_t c = chunks[i];
+            chunk_begin[i + 1] = chunk_begin[i] + std::min(kOrderChunkVertices, n - c * kOrderChunkVertices);
+        }
+        order.resize(n);
+        #pragma omp parallel for num_threads(threads) schedule(dynamic, 64)
+        for (vid_t i = 0; i < num_chunks; ++i) {
+            vid_t first = chunks[i] * kOrderChunkVertices;
+            std::iota(order.begin() + chunk_begin[i], order.begin() + chunk_begin[i + 1], first);
+        }
+    } else {
+        LOG(FATAL) << "unknown stream order: " << order_name;
+    }
+    CHECK_EQ(order.size(), n);
+    order_timer.stop();
+    LOG(INFO) << "stream order (" << order_name << ") time: " << order_timer.get_time();
+    return order;
+}
+
+#endif
@@ -1,6 +1,9 @@
 #ifndef UTIL_HPP
 #define UTIL_HPP
 
+#include <sys/resource.h>
+#include <sstream>
+
 #include "common.hpp"
 
 inline std::string h2hedgelist_name(const std::string &basefilename)
@@ -18,12 +21,37 @@ inline std::string binedgelist_name(const std::string &basefilename)
     return basefilename + ".binedgelist";
 }
 
+inline std::string diskadj_name(const std::string &basefilename)
+{
+    return basefilename + ".disk_adjlist";
+}
+
 inline std::string degree_name(const std::string &basefilename)
 {
     return basefilename + ".degree";
 }
 
-inline std::string edge_partitioned_name(const std::string &basefilename)
+/// partition counts of the FSM output levels: -p, then the coarser -levels
+inline std::vector<int> partition_levels()
+{
+    std::vector<int> levels{FLAGS_p};
+    std::stringstream ss(FLAGS_levels);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (!item.empty()) {
+            levels.push_back(std::stoi(item));
+        }
+    }
+    return levels;
+}
+
+inline std::string split_artifact_name(const std::string &basefilename)
+{
+    std::string split_method = FLAGS_method == "fsm" ? "ne" : FLAGS_method.substr(4);
+    return basefilename + ".fsm_split." + split_method + "_k_" + std::to_string(FLAGS_k) + "." + std::to_string(FLAGS_p);
+}
+
+inline std::string edge_partitioned_name(const std::string &basefilename, int level = 0)
 {
     std::string ret = basefilename + ".edgepart.";
     if (FLAGS_method.substr(0, 3) == "fsm") {
@@ -48,7 +76,11 @@ inline std::string edge_partitioned_name(const std::string &basefilename)
     } else {
         ret += FLAGS_method;
     }
-    ret += "." + std::to_string(FLAGS_p);
+    if (level == 0) {
+        ret += "." + std::to_string(FLAGS_p);
+    } else {
+        ret += "." + std::to_string(partition_levels()[level]) + ".level" + std::to_string(level);
+    }
     return ret;
 }
 
@@ -66,6 +98,14 @@ inline bool is_exists(const std::string &name)
     return (stat(name.c_str(), &buffer) == 0);
 }
 
+/// Peak resident set size of this process so far, in MB
+inline double peak_memory_mb()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024.0;
+}
+
 class Timer
 {
   private: